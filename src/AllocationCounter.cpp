@@ -0,0 +1,85 @@
+#include "AllocationCounter.h"
+
+#ifndef NDEBUG
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    // plain data, so using them from operator new can't allocate
+    thread_local int forbidden = 0;
+    std::atomic<unsigned long long> count{ 0 };
+
+    void* allocate(size_t size)
+    {
+        if (forbidden > 0)
+        {
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+        void* p = std::malloc(size == 0 ? 1 : size);
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+}
+
+AllocationCounter::Forbid::Forbid()
+{
+    forbidden++;
+}
+
+AllocationCounter::Forbid::~Forbid()
+{
+    forbidden--;
+}
+
+AllocationCounter::Allow::Allow() : saved(forbidden)
+{
+    forbidden = 0;
+}
+
+AllocationCounter::Allow::~Allow()
+{
+    forbidden = saved;
+}
+
+unsigned long long AllocationCounter::getCount()
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+#endif
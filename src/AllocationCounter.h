@@ -0,0 +1,53 @@
+#pragma once
+
+// Debug check that the render loop stays off the heap.
+//
+// In builds without NDEBUG the global operator new counts every allocation a
+// thread makes while it holds a Forbid. The renderer forbids allocations for
+// the work on each tile, once the per-thread scratch is in place, and fails
+// the render if the count moves. Cache misses that allocate by design (a
+// texture tile decoded, streamed geometry queued) lift the check with an
+// Allow for their duration. Release builds compile all of this away.
+class AllocationCounter
+{
+public:
+#ifndef NDEBUG
+    class Forbid
+    {
+    public:
+        Forbid();
+        ~Forbid();
+        Forbid(const Forbid&) = delete;
+        Forbid& operator=(const Forbid&) = delete;
+    };
+
+    class Allow
+    {
+        int saved;
+    public:
+        Allow();
+        ~Allow();
+        Allow(const Allow&) = delete;
+        Allow& operator=(const Allow&) = delete;
+    };
+
+    static bool isEnabled() { return true; }
+    // allocations made under a Forbid so far, by any thread
+    static unsigned long long getCount();
+#else
+    class Forbid
+    {
+    public:
+        Forbid() {}
+    };
+
+    class Allow
+    {
+    public:
+        Allow() {}
+    };
+
+    static bool isEnabled() { return false; }
+    static unsigned long long getCount() { return 0; }
+#endif
+};
@@ -0,0 +1,255 @@
+#include <deque>
+#include <limits>
+#include <numeric>
+
+#include "BVH.h"
+
+namespace
+{
+    const int Bins = 12;
+    const int MaxLeafSize = 4;
+    // leaves that SAH would rather not split still get split past this
+    const int MaxUnsplitLeafSize = 16;
+    // keeps traversal within its fixed size stack
+    const int MaxDepth = 60;
+
+    struct Bounds
+    {
+        glm::vec3 lo{ std::numeric_limits<float>::max() };
+        glm::vec3 hi{ -std::numeric_limits<float>::max() };
+
+        void grow(const glm::vec3& p)
+        {
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+
+        void grow(const Bounds& b)
+        {
+            lo = glm::min(lo, b.lo);
+            hi = glm::max(hi, b.hi);
+        }
+
+        float area() const
+        {
+            // empty bounds are inverted; flat ones still have an area
+            glm::vec3 d = hi - lo;
+            return d[0] >= 0.0f ? d[0] * d[1] + d[1] * d[2] + d[2] * d[0] : 0.0f;
+        }
+    };
+
+    struct Bin
+    {
+        Bounds bounds;
+        int count{ 0 };
+    };
+}
+
+void buildBVH(const glm::vec3* v, const Trig* t, size_t count,
+              std::vector<BVHNode>& nodes, std::vector<uint32_t>& order)
+{
+    nodes.clear();
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0u);
+    if (count == 0)
+    {
+        return;
+    }
+
+    std::vector<Bounds> triangleBounds(count);
+    std::vector<glm::vec3> centroids(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int jj = 0; jj < 3; jj++)
+        {
+            triangleBounds[i].grow(v[t[i][jj]]);
+        }
+        centroids[i] = (triangleBounds[i].lo + triangleBounds[i].hi) * 0.5f;
+    }
+
+    nodes.reserve(2 * count);
+    nodes.push_back({ glm::vec3(0.0f), 0, glm::vec3(0.0f), (int32_t)count });
+    struct Task
+    {
+        int node;
+        int depth;
+    };
+    std::vector<Task> tasks{ { 0, 0 } };
+    while (!tasks.empty())
+    {
+        Task task = tasks.back();
+        tasks.pop_back();
+        const int first = nodes[task.node].leftFirst;
+        const int n = nodes[task.node].count;
+
+        Bounds bounds, centroidBounds;
+        for (int i = first; i < first + n; i++)
+        {
+            bounds.grow(triangleBounds[order[i]]);
+            centroidBounds.grow(centroids[order[i]]);
+        }
+        nodes[task.node].boundsMin = bounds.lo;
+        nodes[task.node].boundsMax = bounds.hi;
+        if (n <= MaxLeafSize || task.depth >= MaxDepth)
+        {
+            continue;
+        }
+
+        // cheapest split over the bin boundaries of every axis
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidBounds.hi[axis] - centroidBounds.lo[axis];
+            if (extent <= 0.0f)
+            {
+                continue;
+            }
+            float scale = Bins / extent;
+            Bin bins[Bins];
+            for (int i = first; i < first + n; i++)
+            {
+                int b = std::min(Bins - 1, (int)((centroids[order[i]][axis] - centroidBounds.lo[axis]) * scale));
+                bins[b].bounds.grow(triangleBounds[order[i]]);
+                bins[b].count++;
+            }
+            float rightArea[Bins];
+            int rightCount[Bins];
+            Bounds right;
+            int rightSum = 0;
+            for (int b = Bins - 1; b > 0; b--)
+            {
+                right.grow(bins[b].bounds);
+                rightSum += bins[b].count;
+                rightArea[b] = right.area();
+                rightCount[b] = rightSum;
+            }
+            Bounds left;
+            int leftSum = 0;
+            for (int b = 0; b < Bins - 1; b++)
+            {
+                left.grow(bins[b].bounds);
+                leftSum += bins[b].count;
+                if (leftSum == 0 || rightCount[b + 1] == 0)
+                {
+                    continue;
+                }
+                float cost = left.area() * leftSum + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+        if (bestAxis < 0 || (bestCost >= bounds.area() * n && n <= MaxUnsplitLeafSize))
+        {
+            continue;
+        }
+
+        float lo = centroidBounds.lo[bestAxis];
+        float scale = Bins / (centroidBounds.hi[bestAxis] - lo);
+        uint32_t* middle = std::partition(order.data() + first, order.data() + first + n, [&](uint32_t i)
+        {
+            return std::min(Bins - 1, (int)((centroids[i][bestAxis] - lo) * scale)) < bestSplit;
+        });
+        int leftCount = (int)(middle - (order.data() + first));
+
+        int child = (int)nodes.size();
+        nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount });
+        nodes.push_back({ glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), n - leftCount });
+        nodes[task.node].leftFirst = child;
+        nodes[task.node].count = 0;
+        tasks.push_back({ child + 1, task.depth + 1 });
+        tasks.push_back({ child, task.depth + 1 });
+    }
+}
+
+void layoutTreelets(std::vector<BVHNode>& nodes, std::vector<uint32_t>& order, std::vector<uint32_t>& treelets)
+{
+    treelets.clear();
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    // a unit is the root or a pair of siblings, which have to stay together
+    struct Unit
+    {
+        int first;
+        int size;
+    };
+    std::vector<int> newIndex(nodes.size());
+    std::vector<BVHNode> placed;
+    placed.reserve(nodes.size());
+    std::deque<Unit> roots{ { 0, 1 } };
+    std::deque<Unit> units;
+    while (!roots.empty())
+    {
+        treelets.push_back((uint32_t)placed.size());
+        units.push_back(roots.front());
+        roots.pop_front();
+        int reserved = units.front().size;
+        while (!units.empty())
+        {
+            Unit unit = units.front();
+            units.pop_front();
+            // a subtree that ended early leaves room for the next root, so
+            // small subtrees near the leaves share a treelet
+            if (units.empty() && !roots.empty() && reserved + roots.front().size <= TreeletNodes)
+            {
+                reserved += roots.front().size;
+                units.push_back(roots.front());
+                roots.pop_front();
+            }
+            for (int i = unit.first; i < unit.first + unit.size; i++)
+            {
+                newIndex[i] = (int)placed.size();
+                placed.push_back(nodes[i]);
+                if (nodes[i].isLeaf())
+                {
+                    continue;
+                }
+                // children that don't fit start treelets of their own
+                Unit children{ nodes[i].leftFirst, 2 };
+                if (reserved + 2 <= TreeletNodes)
+                {
+                    reserved += 2;
+                    units.push_back(children);
+                }
+                else
+                {
+                    roots.push_back(children);
+                }
+            }
+        }
+    }
+    treelets.push_back((uint32_t)placed.size());
+
+    // leaves in their new order take their triangles along
+    std::vector<uint32_t> newOrder;
+    newOrder.reserve(order.size());
+    for (BVHNode& node : placed)
+    {
+        if (node.isLeaf())
+        {
+            int first = node.leftFirst;
+            node.leftFirst = (int32_t)newOrder.size();
+            newOrder.insert(newOrder.end(), order.begin() + first, order.begin() + first + node.count);
+        }
+        else
+        {
+            node.leftFirst = newIndex[node.leftFirst];
+        }
+    }
+    nodes.swap(placed);
+    order.swap(newOrder);
+}
+
+BVHBatchScratch& BVHBatchScratch::get()
+{
+    thread_local BVHBatchScratch scratch;
+    return scratch;
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "ObjLoader.h"
+#include "Ray.h"
+#include "Hit.h"
+
+// One node of a flattened bounding volume hierarchy, 32 bytes.
+//
+// Children of an interior node sit next to each other at leftFirst and
+// leftFirst + 1; a leaf covers count triangles starting at leftFirst in
+// the triangle order the builder returns. Plain data, so a built tree can
+// be written to disk and mapped back as is.
+struct BVHNode
+{
+    glm::vec3 boundsMin;
+    int32_t leftFirst;
+    glm::vec3 boundsMax;
+    int32_t count;      // 0 for interior nodes
+
+    bool isLeaf() const { return count > 0; }
+};
+
+// Builds a BVH over the triangles with a binned surface area heuristic.
+// order receives the triangle indices in leaf order; reordering the
+// triangles by it lets leaves address them directly.
+void buildBVH(const glm::vec3* v, const Trig* t, size_t count,
+              std::vector<BVHNode>& nodes, std::vector<uint32_t>& order);
+
+// Nodes per treelet: one 4KB page of nodes.
+const int TreeletNodes = 4096 / sizeof(BVHNode);
+
+// Regroups a built tree into treelets of up to TreeletNodes nodes, each
+// stored contiguously, so traversing inside one touches a single page.
+// Treelets are filled breadth first from their root; one whose subtree runs
+// out early is topped up with the next roots, so small subtrees near the
+// leaves share a treelet. Treelets come one after the other in breadth
+// first order. The leaves are
+// renumbered (and order permuted to match) so the triangles of a treelet
+// are contiguous too. treelets receives the first node of every treelet
+// followed by nodes.size().
+void layoutTreelets(std::vector<BVHNode>& nodes, std::vector<uint32_t>& order, std::vector<uint32_t>& treelets);
+
+// slab test; tNear is where the ray enters the box
+inline bool intersectBounds(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDir,
+                            float tmin, float tmax, float& tNear)
+{
+    glm::vec3 t0 = (node.boundsMin - origin) * invDir;
+    glm::vec3 t1 = (node.boundsMax - origin) * invDir;
+    glm::vec3 lo = glm::min(t0, t1);
+    glm::vec3 hi = glm::max(t0, t1);
+    tNear = std::max(std::max(lo[0], lo[1]), std::max(lo[2], tmin));
+    float tFar = std::min(std::min(hi[0], hi[1]), std::min(hi[2], tmax));
+    return tNear <= tFar;
+}
+
+// Walks the tree front to back. leaf(first, count) intersects a leaf's
+// triangles, updating hit, and returns whether it found anything; subtrees
+// that start beyond the closest hit so far are skipped.
+template <typename LeafFn>
+bool intersectBVH(const BVHNode* nodes, size_t nodeCount, const Ray& ray, const Hit& hit, float tmin, const LeafFn& leaf)
+{
+    if (nodeCount == 0)
+    {
+        return false;
+    }
+    const glm::vec3& origin = ray.getOrigin();
+    const glm::vec3 invDir = glm::vec3(1.0f) / ray.getDirection();
+    float tNear;
+    if (!intersectBounds(nodes[0], origin, invDir, tmin, hit.getT(), tNear))
+    {
+        return false;
+    }
+
+    bool result = false;
+    int stack[64];
+    int depth = 0;
+    int current = 0;
+    while (true)
+    {
+        const BVHNode& node = nodes[current];
+        if (node.isLeaf())
+        {
+            result |= leaf(node.leftFirst, node.count);
+        }
+        else
+        {
+            float nearA, nearB;
+            int a = node.leftFirst;
+            int b = node.leftFirst + 1;
+            bool hitA = intersectBounds(nodes[a], origin, invDir, tmin, hit.getT(), nearA);
+            bool hitB = intersectBounds(nodes[b], origin, invDir, tmin, hit.getT(), nearB);
+            if (hitA && hitB)
+            {
+                if (nearB < nearA)
+                {
+                    std::swap(a, b);
+                }
+                stack[depth++] = b;
+                current = a;
+                continue;
+            }
+            if (hitA || hitB)
+            {
+                current = hitA ? a : b;
+                continue;
+            }
+        }
+        // the closest hit may have moved in front of what is left
+        do
+        {
+            if (depth == 0)
+            {
+                return result;
+            }
+            current = stack[--depth];
+        } while (!intersectBounds(nodes[current], origin, invDir, tmin, hit.getT(), tNear));
+    }
+}
+
+// Per-thread working memory of intersectBVHBatch(), sized by the batch and
+// never shrunk, so steady state traversal does not touch the heap. The
+// renderer reserves it up front for the largest batch it traces.
+struct BVHBatchScratch
+{
+    struct RayState
+    {
+        glm::vec3 invDir;
+        int depth;
+        int stack[64];
+    };
+
+    std::vector<RayState> state;
+    // (treelet, ray) pairs of the rays waiting for a treelet, a min heap
+    std::vector<std::pair<uint32_t, int>> waiting;
+    std::vector<int> batch;
+
+    void reserve(int count)
+    {
+        if ((int)state.size() < count)
+        {
+            state.resize(count);
+            waiting.reserve(count);
+            batch.reserve(count);
+        }
+    }
+
+    static BVHBatchScratch& get();
+};
+
+// Intersects a batch of rays treelet by treelet instead of ray by ray.
+//
+// Every ray keeps its own traversal stack and waits for the treelet its next
+// node lives in. The lowest numbered treelet anyone is waiting for is
+// processed next, for all the rays waiting on it, each running until it has
+// to leave the treelet; so a treelet (and the triangles under it) is paged
+// in once for all the rays that need it rather than once per ray.
+// leaf(ray, first, count) intersects a leaf for one ray, updating hits[ray].
+// treelets is the table from layoutTreelets(); with treeletCount 0 the rays
+// are traced one by one.
+template <typename LeafFn>
+void intersectBVHBatch(const BVHNode* nodes, size_t nodeCount, const uint32_t* treelets, size_t treeletCount,
+                       const Ray* rays, const Hit* hits, int count, float tmin, const LeafFn& leaf)
+{
+    if (nodeCount == 0 || count == 0)
+    {
+        return;
+    }
+    if (treeletCount == 0)
+    {
+        for (int r = 0; r < count; r++)
+        {
+            intersectBVH(nodes, nodeCount, rays[r], hits[r], tmin, [&](int first, int n)
+            {
+                return leaf(r, first, n);
+            });
+        }
+        return;
+    }
+
+    typedef std::pair<uint32_t, int> Waiting;
+    const auto later = std::greater<Waiting>();
+    BVHBatchScratch& scratch = BVHBatchScratch::get();
+    scratch.reserve(count);
+    BVHBatchScratch::RayState* state = scratch.state.data();
+    std::vector<Waiting>& waiting = scratch.waiting;
+    std::vector<int>& batch = scratch.batch;
+    // every ray starts at the root, so this is already a heap
+    waiting.clear();
+    for (int r = 0; r < count; r++)
+    {
+        state[r].invDir = glm::vec3(1.0f) / rays[r].getDirection();
+        state[r].stack[0] = 0;
+        state[r].depth = 1;
+        waiting.push_back(Waiting(0, r));
+    }
+
+    while (!waiting.empty())
+    {
+        const uint32_t t = waiting.front().first;
+        batch.clear();
+        while (!waiting.empty() && waiting.front().first == t)
+        {
+            batch.push_back(waiting.front().second);
+            std::pop_heap(waiting.begin(), waiting.end(), later);
+            waiting.pop_back();
+        }
+        const int lo = (int)treelets[t];
+        const int hi = (int)treelets[t + 1];
+        for (int r : batch)
+        {
+            BVHBatchScratch::RayState& s = state[r];
+            const glm::vec3& origin = rays[r].getOrigin();
+            while (s.depth > 0)
+            {
+                const int current = s.stack[s.depth - 1];
+                if (current < lo || current >= hi)
+                {
+                    uint32_t next = (uint32_t)(std::upper_bound(treelets, treelets + treeletCount + 1, (uint32_t)current) - treelets - 1);
+                    waiting.push_back(Waiting(next, r));
+                    std::push_heap(waiting.begin(), waiting.end(), later);
+                    break;
+                }
+                s.depth--;
+                // tested again on the way out, the closest hit may have
+                // moved in front of it since it was pushed
+                const BVHNode& node = nodes[current];
+                float tNear;
+                if (!intersectBounds(node, origin, s.invDir, tmin, hits[r].getT(), tNear))
+                {
+                    continue;
+                }
+                if (node.isLeaf())
+                {
+                    leaf(r, node.leftFirst, node.count);
+                    continue;
+                }
+                float nearA, nearB;
+                int a = node.leftFirst;
+                int b = node.leftFirst + 1;
+                bool hitA = intersectBounds(nodes[a], origin, s.invDir, tmin, hits[r].getT(), nearA);
+                bool hitB = intersectBounds(nodes[b], origin, s.invDir, tmin, hits[r].getT(), nearB);
+                if (hitA && hitB)
+                {
+                    // the nearer child goes on top
+                    if (nearB < nearA)
+                    {
+                        std::swap(a, b);
+                    }
+                    s.stack[s.depth++] = b;
+                    s.stack[s.depth++] = a;
+                }
+                else if (hitA || hitB)
+                {
+                    s.stack[s.depth++] = hitA ? a : b;
+                }
+            }
+        }
+    }
+}
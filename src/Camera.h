@@ -11,6 +11,14 @@ public:
 	virtual Ray generateRay(const glm::vec2& point) = 0;
 	virtual float getTMin() const = 0;
 	virtual ~Camera() {}
+
+	// ray through pixel (x, y) of a width x height image, offset inside the
+	// pixel by subpixel in [0, 1)^2; (0, 0) is the bottom left corner
+	Ray generatePixelRay(int x, int y, int width, int height, const glm::vec2& subpixel)
+	{
+		return generateRay(glm::vec2((x + subpixel.x) / width * 2.0f - 1.0f,
+		                             (y + subpixel.y) / height * 2.0f - 1.0f));
+	}
 protected:
 	glm::vec3 center;
 	glm::vec3 direction;
@@ -0,0 +1,254 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "Checkpoint.h"
+
+// file layout, all little endian:
+//   char[8]  magic "SRTCKPT"
+//   uint32   version
+//   int32    width, height, passes
+//   uint64   samples
+//   int32    baseSamples, maxSamples
+//   float    errorThreshold
+//   uint32   progressive, sampler, seed
+//   PixelStats[width * height]
+//   uint32   AOV mask (bit i = AovType i)
+//   glm::vec3[width * height] for every AOV plane in the mask
+
+static const char checkpointMagic[8] = { 'S', 'R', 'T', 'C', 'K', 'P', 'T', 0 };
+static const uint32_t checkpointVersion = 2;
+
+void CheckpointInfo::fromSettings(const RenderSettings& settings)
+{
+    baseSamples = settings.baseSamples;
+    maxSamples = settings.maxSamples;
+    errorThreshold = settings.errorThreshold;
+    progressive = settings.progressive;
+    sampler = settings.sampler;
+    seed = settings.seed;
+}
+
+void CheckpointInfo::toSettings(RenderSettings& settings) const
+{
+    settings.baseSamples = baseSamples;
+    settings.maxSamples = maxSamples;
+    settings.errorThreshold = errorThreshold;
+    settings.progressive = progressive;
+    settings.sampler = sampler;
+    settings.seed = seed;
+}
+
+bool saveCheckpoint(const std::string& filename, const CheckpointInfo& info, const Framebuffer& fb)
+{
+    // write next to the real file and rename, so a crash while writing
+    // never destroys the previous checkpoint
+    const std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == NULL)
+    {
+        std::cerr << tmpFilename << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    int32_t dims[3] = { info.width, info.height, info.passes };
+    uint64_t samples = info.samples;
+    int32_t spp[2] = { info.baseSamples, info.maxSamples };
+    uint32_t flags[3] = { info.progressive ? 1u : 0u, (uint32_t)info.sampler, info.seed };
+    size_t count = (size_t)info.width * info.height;
+    uint32_t aovMask = fb.AovMask();
+
+    bool ok = fwrite(checkpointMagic, sizeof(checkpointMagic), 1, file) == 1
+        && fwrite(&checkpointVersion, sizeof(checkpointVersion), 1, file) == 1
+        && fwrite(dims, sizeof(dims), 1, file) == 1
+        && fwrite(&samples, sizeof(samples), 1, file) == 1
+        && fwrite(spp, sizeof(spp), 1, file) == 1
+        && fwrite(&info.errorThreshold, sizeof(float), 1, file) == 1
+        && fwrite(flags, sizeof(flags), 1, file) == 1
+        && fwrite(fb.Data(), sizeof(PixelStats), count, file) == count
+        && fwrite(&aovMask, sizeof(aovMask), 1, file) == 1;
+    for (int type = 0; ok && type < AovCount; type++)
+    {
+        if (aovMask & (1u << type))
+        {
+            ok = fwrite(fb.AovData((AovType)type), sizeof(glm::vec3), count, file) == count;
+        }
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok)
+    {
+        std::cerr << "could not write checkpoint " << tmpFilename << std::endl;
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    return std::rename(tmpFilename.c_str(), filename.c_str()) == 0;
+}
+
+Framebuffer* loadCheckpoint(const std::string& filename, CheckpointInfo& info)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        std::cerr << filename << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    char magic[8];
+    uint32_t version = 0;
+    int32_t dims[3];
+    uint64_t samples;
+    int32_t spp[2];
+    uint32_t flags[3];
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1
+        && memcmp(magic, checkpointMagic, sizeof(magic)) == 0
+        && fread(&version, sizeof(version), 1, file) == 1
+        && version == checkpointVersion
+        && fread(dims, sizeof(dims), 1, file) == 1
+        && fread(&samples, sizeof(samples), 1, file) == 1
+        && fread(spp, sizeof(spp), 1, file) == 1
+        && fread(&info.errorThreshold, sizeof(float), 1, file) == 1
+        && fread(flags, sizeof(flags), 1, file) == 1
+        && dims[0] > 0 && dims[1] > 0;
+    if (!ok)
+    {
+        std::cerr << filename << ": not a checkpoint file (version " << checkpointVersion << ")" << std::endl;
+        fclose(file);
+        return nullptr;
+    }
+
+    info.width = dims[0];
+    info.height = dims[1];
+    info.passes = dims[2];
+    info.samples = samples;
+    info.baseSamples = spp[0];
+    info.maxSamples = spp[1];
+    info.progressive = flags[0] != 0;
+    info.sampler = (SamplerType)flags[1];
+    info.seed = flags[2];
+
+    Framebuffer* fb = new Framebuffer(info.width, info.height);
+    size_t count = (size_t)info.width * info.height;
+    uint32_t aovMask = 0;
+    ok = fread(fb->Data(), sizeof(PixelStats), count, file) == count
+        && fread(&aovMask, sizeof(aovMask), 1, file) == 1;
+    for (int type = 0; ok && type < AovCount; type++)
+    {
+        if (aovMask & (1u << type))
+        {
+            fb->EnableAov((AovType)type);
+            ok = fread(fb->AovData((AovType)type), sizeof(glm::vec3), count, file) == count;
+        }
+    }
+    if (!ok)
+    {
+        std::cerr << filename << ": truncated checkpoint" << std::endl;
+        delete fb;
+        fb = nullptr;
+    }
+    fclose(file);
+    return fb;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& filename) : filename(filename)
+{
+    worker = std::thread(&CheckpointWriter::run, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void CheckpointWriter::submit(const Framebuffer& fb, const CheckpointInfo& info)
+{
+    std::unique_ptr<Framebuffer> snapshot;
+    if (!fb.IsMapped())
+    {
+        {
+            // take whichever snapshot the writer is not reading from
+            std::lock_guard<std::mutex> lock(mutex);
+            if (spare)
+            {
+                snapshot = std::move(spare);
+            }
+            else if (pending)
+            {
+                snapshot = std::move(pending);
+                hasPending = false;
+            }
+        }
+        if (!snapshot || snapshot->Width() != fb.Width() || snapshot->Height() != fb.Height())
+        {
+            snapshot.reset(new Framebuffer(fb.Width(), fb.Height()));
+        }
+        snapshot->CopyFrom(fb);
+    }
+    else
+    {
+        fb.Flush();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending)
+        {
+            spare = std::move(pending);
+        }
+        pending = std::move(snapshot);
+        pendingSource = pending ? pending.get() : &fb;
+        pendingInfo = info;
+        pendingInfo.width = fb.Width();
+        pendingInfo.height = fb.Height();
+        hasPending = true;
+    }
+    wake.notify_one();
+}
+
+void CheckpointWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return !hasPending && !writing; });
+}
+
+void CheckpointWriter::run()
+{
+    std::unique_ptr<Framebuffer> snapshot;
+    const Framebuffer* source;
+    CheckpointInfo info;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]() { return hasPending || quit; });
+        if (!hasPending)
+        {
+            break;
+        }
+        snapshot = std::move(pending);
+        source = pendingSource;
+        info = pendingInfo;
+        hasPending = false;
+        writing = true;
+
+        lock.unlock();
+        if (saveCheckpoint(filename, info, *source))
+        {
+            std::cout << "checkpoint written after " << info.passes << " passes" << std::endl;
+        }
+        lock.lock();
+
+        if (snapshot)
+        {
+            spare = std::move(snapshot);
+        }
+        writing = false;
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Framebuffer.h"
+#include "Renderer.h"
+
+// Everything besides the pixels that a resumed render needs in order to
+// produce the same image as an uninterrupted one. Sampler indices are not
+// stored separately: a pixel's next sample index is its sample count.
+struct CheckpointInfo
+{
+    int width{ 0 };
+    int height{ 0 };
+    int passes{ 0 };
+    unsigned long long samples{ 0 };
+    int baseSamples{ 1 };
+    int maxSamples{ 1 };
+    float errorThreshold{ 0.0f };
+    bool progressive{ false };
+    SamplerType sampler{ SamplerType::Sobol };
+    uint32_t seed{ 0 };
+
+    void fromSettings(const RenderSettings& settings);
+    void toSettings(RenderSettings& settings) const;
+};
+
+bool saveCheckpoint(const std::string& filename, const CheckpointInfo& info, const Framebuffer& fb);
+
+// returns nullptr if the file is missing or not a checkpoint of this version
+Framebuffer* loadCheckpoint(const std::string& filename, CheckpointInfo& info);
+
+// Writes checkpoints on a background thread. submit() copies a heap
+// framebuffer into one of two reused snapshots and returns; if the previous
+// checkpoint is still being written the older pending snapshot is simply
+// overwritten. A mapped framebuffer is not copied at all: its pages are
+// flushed and the writer reads the live mapping, which is safe to store
+// while the next pass runs because every pixel resumes from its own count.
+class CheckpointWriter
+{
+    std::string filename;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    // snapshot waiting to be written and the one free for the next submit
+    std::unique_ptr<Framebuffer> pending;
+    std::unique_ptr<Framebuffer> spare;
+    // what the pending checkpoint is written from: pending, or a mapped
+    // framebuffer owned by the caller
+    const Framebuffer* pendingSource{ nullptr };
+    CheckpointInfo pendingInfo;
+    bool hasPending{ false };
+    bool writing{ false };
+    bool quit{ false };
+
+    void run();
+public:
+    CheckpointWriter() = delete;
+    CheckpointWriter(const std::string& filename);
+    ~CheckpointWriter();
+
+    // a mapped fb must stay alive until flush() returns
+    void submit(const Framebuffer& fb, const CheckpointInfo& info);
+
+    // blocks until every submitted checkpoint is on disk
+    void flush();
+};
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Denoiser.h"
+#include "Parallel.h"
+
+// rows handed to a worker at a time
+static const int rowBlock = 16;
+
+namespace
+{
+    struct Guide
+    {
+        glm::vec3 normal{ 0.0f };
+        glm::vec3 albedo{ 0.0f };
+        float depth{ 0.0f };
+        bool hit{ false };
+    };
+}
+
+void denoise(const Framebuffer& fb, Image& image, const DenoiseSettings& settings)
+{
+    assert(fb.HasAov(AovNormal) && fb.HasAov(AovDepth) && fb.HasAov(AovAlbedo));
+    assert(image.Width() == fb.Width() && image.Height() == fb.Height());
+
+    const int width = fb.Width();
+    const int height = fb.Height();
+    const int blocks = (height + rowBlock - 1) / rowBlock;
+    const size_t count = (size_t)width * height;
+
+    std::vector<Guide> guides(count);
+    std::vector<glm::vec3> color(count), colorOut(count);
+    std::vector<float> variance(count), varianceOut(count);
+
+    parallelFor(blocks, settings.threads, [&](int block)
+    {
+        for (int y = block * rowBlock; y < std::min(height, (block + 1) * rowBlock); y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                size_t i = (size_t)y * width + x;
+                const PixelStats& p = fb.GetStats(x, y);
+                color[i] = p.mean;
+                // variance of the mean, not of a single sample
+                variance[i] = p.count > 0 ? fb.GetVariance(x, y) / (float)p.count : 0.0f;
+                Guide& g = guides[i];
+                g.hit = fb.GetAov(AovHitCount, x, y)[0] > 0.0f;
+                if (g.hit)
+                {
+                    glm::vec3 n = fb.GetAov(AovNormal, x, y);
+                    float len = glm::length(n);
+                    g.normal = len > 0.0f ? n / len : n;
+                    g.depth = fb.GetAov(AovDepth, x, y)[0];
+                    g.albedo = fb.GetAov(AovAlbedo, x, y);
+                }
+            }
+        }
+    });
+
+    static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    for (int level = 0; level < settings.iterations; level++)
+    {
+        const int step = 1 << level;
+        parallelFor(blocks, settings.threads, [&](int block)
+        {
+            for (int y = block * rowBlock; y < std::min(height, (block + 1) * rowBlock); y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    const size_t i = (size_t)y * width + x;
+                    const Guide& gp = guides[i];
+                    const float lp = luminance(color[i]);
+                    const float sigmaL = settings.sigmaColor * sqrtf(variance[i]) + 1e-4f;
+
+                    glm::vec3 sum(0.0f);
+                    float varSum = 0.0f;
+                    float weightSum = 0.0f;
+                    for (int dy = -2; dy <= 2; dy++)
+                    {
+                        int qy = y + dy * step;
+                        if (qy < 0 || qy >= height)
+                        {
+                            continue;
+                        }
+                        for (int dx = -2; dx <= 2; dx++)
+                        {
+                            int qx = x + dx * step;
+                            if (qx < 0 || qx >= width)
+                            {
+                                continue;
+                            }
+                            const size_t j = (size_t)qy * width + qx;
+                            const Guide& gq = guides[j];
+                            float w = kernel[dx + 2] * kernel[dy + 2];
+
+                            // never mix geometry with background
+                            if (gp.hit != gq.hit)
+                            {
+                                continue;
+                            }
+                            if (gp.hit)
+                            {
+                                // normals that averaged out to zero say nothing
+                                // about the surface, so they don't weigh in
+                                if (glm::dot(gp.normal, gp.normal) > 0.0f && glm::dot(gq.normal, gq.normal) > 0.0f)
+                                {
+                                    float nd = std::max(0.0f, glm::dot(gp.normal, gq.normal));
+                                    w *= powf(nd, settings.sigmaNormal);
+                                }
+                                float dz = fabsf(gp.depth - gq.depth) / (std::max(1e-4f, gp.depth) * settings.sigmaDepth * step);
+                                w *= expf(-dz);
+                                glm::vec3 da = gp.albedo - gq.albedo;
+                                w *= expf(-glm::dot(da, da) / (settings.sigmaAlbedo * settings.sigmaAlbedo));
+                            }
+                            w *= expf(-fabsf(lp - luminance(color[j])) / sigmaL);
+
+                            sum += color[j] * w;
+                            varSum += variance[j] * w * w;
+                            weightSum += w;
+                        }
+                    }
+                    // the centre pixel weighs in unless its guides aren't
+                    // finite, in which case the pixel is kept as it is
+                    if (weightSum > 0.0f)
+                    {
+                        colorOut[i] = sum / weightSum;
+                        varianceOut[i] = varSum / (weightSum * weightSum);
+                    }
+                    else
+                    {
+                        colorOut[i] = color[i];
+                        varianceOut[i] = variance[i];
+                    }
+                }
+            }
+        });
+        color.swap(colorOut);
+        variance.swap(varianceOut);
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            image.SetPixel(x, y, color[(size_t)y * width + x]);
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include "Image.h"
+
+struct DenoiseSettings
+{
+    int iterations{ 5 };        // a-trous levels, the footprint doubles each one
+    float sigmaColor{ 4.0f };   // luminance edge stopping, in standard deviations
+    float sigmaNormal{ 64.0f }; // exponent on the normal dot product
+    float sigmaDepth{ 0.1f };   // depth difference scale, relative to the depth
+    float sigmaAlbedo{ 0.1f };
+    int threads{ 0 };
+};
+
+// Edge-aware a-trous wavelet filter over the float framebuffer. Neighbours
+// are weighted by a B3 spline kernel and edge stopping functions on the
+// normal, depth and albedo AOVs and on the luminance difference relative to
+// the estimated noise; the variance estimate is filtered along with the
+// colour so later levels smooth less where earlier ones already did.
+//
+// The framebuffer needs the AovNormal, AovDepth and AovAlbedo planes; the
+// result goes to image, which must have the framebuffer's size.
+void denoise(const Framebuffer& fb, Image& image, const DenoiseSettings& settings);
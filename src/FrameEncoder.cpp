@@ -0,0 +1,91 @@
+#include <algorithm>
+
+#include "FrameEncoder.h"
+
+FrameEncoder::FrameEncoder(int threads, int buffers)
+{
+    buffers = std::max(1, buffers);
+    for (int i = 0; i < buffers; i++)
+    {
+        // images get their real size on first use
+        images.emplace_back(new Image(1, 1));
+        freeImages.push_back(images.back().get());
+    }
+    for (int t = 0; t < std::max(1, threads); t++)
+    {
+        workers.emplace_back(&FrameEncoder::run, this);
+    }
+}
+
+FrameEncoder::~FrameEncoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+Image* FrameEncoder::acquire(int width, int height, bool halfFloat)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    returned.wait(lock, [this]() { return !freeImages.empty(); });
+    Image* image = freeImages.back();
+    freeImages.pop_back();
+    if (image->Width() != width || image->Height() != height || image->IsHalf() != halfFloat)
+    {
+        for (auto& owned : images)
+        {
+            if (owned.get() == image)
+            {
+                owned.reset(new Image(width, height, halfFloat));
+                image = owned.get();
+            }
+        }
+    }
+    return image;
+}
+
+void FrameEncoder::submit(Image* image, const std::string& filename, const QuantizeSettings& settings)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back({ image, filename, settings });
+    }
+    wake.notify_one();
+}
+
+void FrameEncoder::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return queue.empty() && writing == 0; });
+}
+
+void FrameEncoder::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]() { return !queue.empty() || quit; });
+        if (queue.empty())
+        {
+            break;
+        }
+        Job job = queue.front();
+        queue.pop_front();
+        writing++;
+
+        lock.unlock();
+        job.image->SaveImage(job.filename, job.settings);
+        lock.lock();
+
+        writing--;
+        freeImages.push_back(job.image);
+        returned.notify_one();
+        idle.notify_all();
+    }
+}
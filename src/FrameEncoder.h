@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Image.h"
+#include "ImageFormats.h"
+
+// Encodes and writes finished frames on background threads so rendering
+// can go on while the disk catches up.
+//
+// The encoder owns a small pool of images (two by default, so frames are
+// double buffered): acquire() hands out a free one to resolve the next
+// frame into, submit() queues it to be saved under a filename and returns
+// it to the pool once it is on disk. When every image is still waiting to
+// be written, acquire() blocks, which is the backpressure on the renderer
+// when the disk is the slower side.
+//
+// With one thread frames are written in the order they were submitted, so
+// repeatedly saving to the same file (progressive passes) is safe.
+class FrameEncoder
+{
+    struct Job
+    {
+        Image* image;
+        std::string filename;
+        QuantizeSettings settings;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable returned;
+    std::condition_variable idle;
+    std::deque<Job> queue;
+    std::vector<std::unique_ptr<Image>> images;   // the whole pool
+    std::vector<Image*> freeImages;
+    int writing{ 0 };
+    bool quit{ false };
+
+    void run();
+public:
+    FrameEncoder() = delete;
+    FrameEncoder(int threads = 1, int buffers = 2);
+    ~FrameEncoder();
+    FrameEncoder(const FrameEncoder&) = delete;
+    FrameEncoder& operator=(const FrameEncoder&) = delete;
+
+    // a pool image of the given size and storage, waits for one to be free
+    Image* acquire(int width, int height, bool halfFloat = false);
+
+    // queues image, which must come from acquire(), to be saved
+    void submit(Image* image, const std::string& filename, const QuantizeSettings& settings = QuantizeSettings());
+
+    // blocks until every submitted frame is on disk
+    void flush();
+};
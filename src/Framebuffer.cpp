@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "Framebuffer.h"
+
+// plane offsets in a backing file are multiples of this, so every plane
+// can be backed by huge pages
+static const size_t MappingAlignment = 2 << 20;
+
+static size_t alignMapping(size_t n)
+{
+    return (n + MappingAlignment - 1) / MappingAlignment * MappingAlignment;
+}
+
+// what an AOV plane holds before the first sample
+static glm::vec3 aovClearValue(AovType type)
+{
+    return glm::vec3(type == AovMaterialId ? -1.0f : 0.0f);
+}
+
+Framebuffer::Framebuffer(int w, int h) : width(w), height(h), ownedPixels((size_t)w * h)
+{
+    pixels = ownedPixels.data();
+}
+
+Framebuffer::Framebuffer(int w, int h, const std::string& backingFile) : width(w), height(h)
+{
+    const size_t count = (size_t)w * h;
+    // the header has the first block to itself; the file is sparse, so
+    // room for planes that are never enabled costs nothing
+    size_t size = MappingAlignment;
+    const size_t pixelOffset = size;
+    size += alignMapping(count * sizeof(PixelStats));
+    size_t aovOffsets[AovCount];
+    for (int type = 0; type < AovCount; type++)
+    {
+        aovOffsets[type] = size;
+        size += alignMapping(count * sizeof(glm::vec3));
+    }
+
+    mapping.reset(new MappedRegion());
+    if (!mapping->create(backingFile, size))
+    {
+        std::cerr << "WARNING: keeping the framebuffer in memory instead of " << backingFile << std::endl;
+        mapping.reset();
+        ownedPixels.resize(count);
+        pixels = ownedPixels.data();
+        return;
+    }
+
+    FramebufferFileHeader* fileHeader = header();
+    memcpy(fileHeader->magic, "SRTFBUF", 8);
+    fileHeader->version = 1;
+    fileHeader->width = w;
+    fileHeader->height = h;
+    fileHeader->aovMask = 0;
+    fileHeader->pixelStride = sizeof(PixelStats);
+    fileHeader->reserved = 0;
+    fileHeader->pixelOffset = pixelOffset;
+    for (int type = 0; type < AovCount; type++)
+    {
+        fileHeader->aovOffsets[type] = aovOffsets[type];
+    }
+    // the file starts out zeroed, which is exactly a PixelStats with no samples
+    pixels = (PixelStats*)(mapping->data() + pixelOffset);
+}
+
+Framebuffer::Framebuffer(const Framebuffer& other) : width(other.width), height(other.height)
+{
+    const size_t count = (size_t)width * height;
+    ownedPixels.assign(other.pixels, other.pixels + count);
+    pixels = ownedPixels.data();
+    for (int type = 0; type < AovCount; type++)
+    {
+        if (other.aovs[type] != nullptr)
+        {
+            ownedAovs[type].assign(other.aovs[type], other.aovs[type] + count);
+            aovs[type] = ownedAovs[type].data();
+        }
+    }
+}
+
+void Framebuffer::CopyFrom(const Framebuffer& other)
+{
+    assert(other.width == width && other.height == height);
+    const size_t count = (size_t)width * height;
+    std::copy(other.pixels, other.pixels + count, pixels);
+    for (int type = 0; type < AovCount; type++)
+    {
+        if (other.aovs[type] != nullptr)
+        {
+            EnableAov((AovType)type);
+            std::copy(other.aovs[type], other.aovs[type] + count, aovs[type]);
+        }
+    }
+}
+
+void Framebuffer::Clear()
+{
+    const size_t count = (size_t)width * height;
+    std::fill(pixels, pixels + count, PixelStats());
+    for (int type = 0; type < AovCount; type++)
+    {
+        if (aovs[type] != nullptr)
+        {
+            std::fill(aovs[type], aovs[type] + count, aovClearValue((AovType)type));
+        }
+    }
+}
+
+void Framebuffer::Flush() const
+{
+    if (mapping)
+    {
+        mapping->flush();
+    }
+}
+
+void Framebuffer::EnableAov(AovType type)
+{
+    if (HasAov(type))
+    {
+        return;
+    }
+    const size_t count = (size_t)width * height;
+    if (mapping)
+    {
+        aovs[type] = (glm::vec3*)(mapping->data() + header()->aovOffsets[type]);
+        header()->aovMask |= 1u << type;
+    }
+    else
+    {
+        ownedAovs[type].resize(count);
+        aovs[type] = ownedAovs[type].data();
+    }
+    std::fill(aovs[type], aovs[type] + count, aovClearValue(type));
+    if (type != AovHitCount)
+    {
+        EnableAov(AovHitCount);
+    }
+}
+
+unsigned int Framebuffer::AovMask() const
+{
+    unsigned int mask = 0;
+    for (int type = 0; type < AovCount; type++)
+    {
+        if (HasAov((AovType)type))
+        {
+            mask |= 1u << type;
+        }
+    }
+    return mask;
+}
+
+float Framebuffer::GetVariance(int x, int y) const
+{
+    const PixelStats& p = GetStats(x, y);
+    if (p.count < 2)
+    {
+        return 0.0f;
+    }
+    return p.m2 / (float)(p.count - 1);
+}
+
+float Framebuffer::GetError(int x, int y) const
+{
+    const PixelStats& p = GetStats(x, y);
+    if (p.count < 2)
+    {
+        return std::numeric_limits<float>::infinity();
+    }
+    float stdError = sqrtf(GetVariance(x, y) / (float)p.count);
+    // small bias keeps almost black pixels from demanding every sample
+    return stdError / (luminance(p.mean) + 0.01f);
+}
+
+void Framebuffer::Resolve(Image& image) const
+{
+    assert(image.Width() == width);
+    assert(image.Height() == height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            image.SetPixel(x, y, pixels[(size_t)y * width + x].mean);
+        }
+    }
+}
+
+void Framebuffer::ResolveSampleCounts(Image& image, unsigned int maxCount) const
+{
+    assert(image.Width() == width);
+    assert(image.Height() == height);
+    float scale = maxCount > 0 ? 1.0f / (float)maxCount : 0.0f;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            image.SetPixel(x, y, glm::vec3(pixels[(size_t)y * width + x].count * scale));
+        }
+    }
+}
+
+void Framebuffer::ResolveAov(AovType type, Image& image, float minDepth, float maxDepth, unsigned int maxCount) const
+{
+    assert(HasAov(type));
+    assert(image.Width() == width);
+    assert(image.Height() == height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            size_t i = (size_t)y * width + x;
+            bool hit = aovs[AovHitCount][i][0] > 0.0f;
+            glm::vec3 value(0.0f);
+            switch (type)
+            {
+            case AovDepth:
+                if (hit)
+                {
+                    float t = GetAov(AovDepth, x, y)[0];
+                    float d = (maxDepth - t) / (maxDepth - minDepth);
+                    value = glm::vec3(std::min(1.0f, std::max(0.0f, d)));
+                }
+                break;
+            case AovNormal:
+                if (hit)
+                {
+                    value = GetAov(AovNormal, x, y) * 0.5f + glm::vec3(0.5f);
+                }
+                break;
+            case AovAlbedo:
+                value = GetAov(AovAlbedo, x, y);
+                break;
+            case AovMaterialId:
+                // the 8 bit conversion rounds, so this is byte id + 1 and
+                // 0 stays free for pixels that hit nothing
+                value = glm::vec3((aovs[AovMaterialId][i][0] + 1.0f) / 255.0f);
+                break;
+            case AovHitCount:
+                value = glm::vec3(aovs[AovHitCount][i][0] / (float)std::max(1u, maxCount));
+                break;
+            default:
+                break;
+            }
+            image.SetPixel(x, y, value);
+        }
+    }
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Image.h"
+#include "MappedFile.h"
+
+// Per-pixel accumulation state. The mean is updated incrementally and
+// m2 tracks the sum of squared deviations of the sample luminance
+// (Welford), which is what the adaptive sampler uses as its error estimate.
+struct PixelStats
+{
+    glm::vec3 mean{ 0.0f };
+    float m2{ 0.0f };
+    unsigned int count{ 0 };
+};
+
+// Arbitrary output variables, accumulated from the same primary rays as the
+// beauty pass. Each one is a plane of glm::vec3 holding per-pixel sums over
+// the samples that hit something; the hit count plane holds that number and
+// is allocated whenever any other AOV is.
+enum AovType
+{
+    AovDepth,       // x: sum of t
+    AovNormal,      // sum of unit normals
+    AovAlbedo,      // sum of albedo
+    AovMaterialId,  // x: id of the first material hit, -1 if none yet
+    AovHitCount,    // x: samples that hit geometry
+    AovCount
+};
+
+// what one primary ray contributes to the AOV planes
+struct AovSample
+{
+    bool hit{ false };
+    float depth{ 0.0f };
+    glm::vec3 normal{ 0.0f };
+    glm::vec3 albedo{ 0.0f };
+    int materialId{ -1 };
+};
+
+// Start of a framebuffer backing file, for viewers that map it read-only.
+// The pixel array and every AOV plane start at their own offset (planes not
+// in aovMask are all zeros and take no space in the sparse file).
+struct FramebufferFileHeader
+{
+    char magic[8];                  // "SRTFBUF"
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint32_t aovMask;               // planes in use, updated as they are enabled
+    uint32_t pixelStride;           // sizeof(PixelStats), the mean is the first 3 floats
+    uint32_t reserved;
+    uint64_t pixelOffset;
+    uint64_t aovOffsets[AovCount];  // planes of 3 floats per pixel
+};
+
+inline float luminance(const glm::vec3& c)
+{
+    return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+// Float accumulation buffer that lives next to the 8 bit output Image.
+// Samples are added here and resolved into an Image when it is time to save.
+class Framebuffer
+{
+
+public:
+
+    Framebuffer(int w, int h);
+    // keeps the pixels and AOV planes in a shared mapping of backingFile
+    // (see FramebufferFileHeader) instead of on the heap, so a render can
+    // be larger than RAM and be watched from another process; falls back
+    // to the heap if the file can't be created
+    Framebuffer(int w, int h, const std::string& backingFile);
+    // copies always live on the heap
+    Framebuffer(const Framebuffer& other);
+    Framebuffer& operator=(const Framebuffer&) = delete;
+
+    bool IsMapped() const
+    {
+        return mapping != nullptr;
+    }
+
+    // takes over the samples and AOV planes of a framebuffer of the same size
+    void CopyFrom(const Framebuffer& other);
+
+    // drops every sample, so the framebuffer can be rendered into afresh;
+    // enabled AOV planes stay enabled
+    void Clear();
+
+    // schedules a mapped framebuffer's pages for writing back to its
+    // backing file; a no-op on the heap
+    void Flush() const;
+
+    int Width() const
+    {
+        return width;
+    }
+
+    int Height() const
+    {
+        return height;
+    }
+
+    void EnableAov(AovType type);
+
+    bool HasAov(AovType type) const
+    {
+        return aovs[type] != nullptr;
+    }
+
+    // bit i is set when plane i is allocated
+    unsigned int AovMask() const;
+
+    // raw row major pixel data, used for checkpoints
+    PixelStats* Data()
+    {
+        return pixels;
+    }
+
+    const PixelStats* Data() const
+    {
+        return pixels;
+    }
+
+    glm::vec3* AovData(AovType type)
+    {
+        return aovs[type];
+    }
+
+    const glm::vec3* AovData(AovType type) const
+    {
+        return aovs[type];
+    }
+
+    const PixelStats& GetStats(int x, int y) const
+    {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        return pixels[(size_t)y * width + x];
+    }
+
+    void AddSample(int x, int y, const glm::vec3& color)
+    {
+        assert(x >= 0 && x < width);
+        assert(y >= 0 && y < height);
+        PixelStats& p = pixels[(size_t)y * width + x];
+        float oldLum = luminance(p.mean);
+        p.count++;
+        p.mean += (color - p.mean) / (float)p.count;
+        float lum = luminance(color);
+        p.m2 += (lum - oldLum) * (lum - luminance(p.mean));
+    }
+
+    void AddSample(int x, int y, const glm::vec3& color, const AovSample& aov)
+    {
+        AddSample(x, y, color);
+        if (!aov.hit || aovs[AovHitCount] == nullptr)
+        {
+            return;
+        }
+        size_t i = (size_t)y * width + x;
+        aovs[AovHitCount][i][0] += 1.0f;
+        if (aovs[AovDepth] != nullptr)
+        {
+            aovs[AovDepth][i][0] += aov.depth;
+        }
+        if (aovs[AovNormal] != nullptr)
+        {
+            aovs[AovNormal][i] += aov.normal;
+        }
+        if (aovs[AovAlbedo] != nullptr)
+        {
+            aovs[AovAlbedo][i] += aov.albedo;
+        }
+        if (aovs[AovMaterialId] != nullptr && aovs[AovMaterialId][i][0] < 0.0f)
+        {
+            aovs[AovMaterialId][i][0] = (float)aov.materialId;
+        }
+    }
+
+    // mean AOV value over the samples of (x, y) that hit something, zero
+    // for pixels that never hit; not meaningful for AovMaterialId
+    glm::vec3 GetAov(AovType type, int x, int y) const
+    {
+        size_t i = (size_t)y * width + x;
+        float hits = aovs[AovHitCount][i][0];
+        if (type == AovHitCount || hits == 0.0f)
+        {
+            return aovs[type][i];
+        }
+        return aovs[type][i] / hits;
+    }
+
+    // sample variance of the luminance of pixel (x, y)
+    float GetVariance(int x, int y) const;
+
+    // relative standard error of the pixel mean; infinite until the pixel
+    // has enough samples to estimate it
+    float GetError(int x, int y) const;
+
+    void Resolve(Image& image) const;
+
+    // writes count / maxCount as a grey level, handy for tuning thresholds
+    void ResolveSampleCounts(Image& image, unsigned int maxCount) const;
+
+    // converts an AOV plane into something an 8 bit image can hold:
+    // depth maps [minDepth, maxDepth] to [1, 0] (near is bright, misses are
+    // black), normals to 0.5 * n + 0.5, material ids to (id + 1) / 255 and
+    // hit counts to hits / maxCount
+    void ResolveAov(AovType type, Image& image, float minDepth = 0.0f, float maxDepth = 1.0f, unsigned int maxCount = 1) const;
+
+private:
+
+    int width;
+    int height;
+    PixelStats* pixels{ nullptr };
+    glm::vec3* aovs[AovCount]{};
+
+    // where the pointers above point: the heap, or the backing file
+    std::vector<PixelStats> ownedPixels;
+    std::vector<glm::vec3> ownedAovs[AovCount];
+    std::unique_ptr<MappedRegion> mapping;
+
+    FramebufferFileHeader* header() const
+    {
+        return (FramebufferFileHeader*)mapping->data();
+    }
+
+};
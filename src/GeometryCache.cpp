@@ -0,0 +1,126 @@
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#include "GeometryCache.h"
+
+namespace
+{
+    // the same file reached through different relative paths is one mesh
+    std::string canonicalPath(const std::string& filename)
+    {
+        std::error_code ec;
+        std::string path = std::filesystem::weakly_canonical(filename, ec).string();
+        return ec ? filename : path;
+    }
+
+    // maps the mesh cache if it is up to date, otherwise parses the OBJ,
+    // builds normals and the BVH and writes the cache for next time
+    std::shared_ptr<MeshData> loadMesh(const std::string& filename)
+    {
+        std::shared_ptr<MeshData> data = std::make_shared<MeshData>();
+        auto start = std::chrono::steady_clock::now();
+        if (loadMeshCache(filename, *data))
+        {
+            std::cout << filename << ": " << data->vertexCount << " vertices, " << data->triangleCount
+                      << " triangles mapped from " << meshCachePath(filename) << " in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+            return data;
+        }
+        ObjData obj;
+        ObjLoadStats stats;
+        if (!loadObj(filename, obj, 0, &stats))
+        {
+            std::cout << "Cannot open " << filename << "\n";
+            return data;
+        }
+        MeshLayoutStats layout;
+        data->build(obj, &layout);
+        std::cout << filename << ": " << data->vertexCount << " vertices, " << data->triangleCount << " triangles, "
+                  << stats.bytes / (1024.0 * 1024.0) << " MB in " << stats.seconds << " s ("
+                  << stats.megabytesPerSecond() << " MB/s), " << data->nodeCount << " BVH nodes, " << layout << "\n";
+        writeMeshCache(filename, *data);
+        return data;
+    }
+}
+
+GeometryCache& GeometryCache::instance()
+{
+    static GeometryCache cache;
+    return cache;
+}
+
+std::shared_ptr<const MeshData> GeometryCache::getMesh(const std::string& filename)
+{
+    std::string path = canonicalPath(filename);
+
+    PendingMesh loading;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry& entry = meshes[path];
+        std::shared_ptr<const MeshData> data = entry.data.lock();
+        if (data)
+        {
+            hits++;
+            return data;
+        }
+        loading = entry.loading;
+        if (loading.valid())
+        {
+            hits++;
+        }
+    }
+    if (loading.valid())
+    {
+        return loading.get();
+    }
+
+    // loading can take seconds, so it runs without the lock; if two threads
+    // race on the same file the first one to finish wins
+    std::shared_ptr<const MeshData> loaded = loadMesh(filename);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = meshes[path];
+    std::shared_ptr<const MeshData> data = entry.data.lock();
+    if (data)
+    {
+        hits++;
+        return data;
+    }
+    loads++;
+    entry.data = loaded;
+    return loaded;
+}
+
+GeometryCache::PendingMesh GeometryCache::requestMesh(const std::string& filename, ThreadPool& pool)
+{
+    std::string path = canonicalPath(filename);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = meshes[path];
+    std::shared_ptr<const MeshData> data = entry.data.lock();
+    if (data)
+    {
+        hits++;
+        std::promise<std::shared_ptr<const MeshData>> ready;
+        ready.set_value(data);
+        return ready.get_future().share();
+    }
+    if (entry.loading.valid())
+    {
+        hits++;
+        return entry.loading;
+    }
+    loads++;
+    entry.loading = pool.submit([this, filename, path]()
+    {
+        std::shared_ptr<const MeshData> loaded = loadMesh(filename);
+        // the entry must not keep the data alive, only the waiters do
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry& entry = meshes[path];
+        entry.data = loaded;
+        entry.loading = PendingMesh();
+        return loaded;
+    }).share();
+    return entry.loading;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "MeshCache.h"
+#include "ThreadPool.h"
+
+// Process-wide cache that shares mesh data between TriangleMesh references.
+//
+// getMesh() hands out one MeshData per canonical path, so a scene that
+// places the same OBJ under 500 transforms loads, builds and keeps it once.
+// The data is immutable once loaded; each Mesh that references it brings
+// its own material. Entries are held weakly and go away with the last mesh
+// that uses them.
+class GeometryCache
+{
+public:
+    typedef std::shared_future<std::shared_ptr<const MeshData>> PendingMesh;
+
+private:
+    struct Entry
+    {
+        std::weak_ptr<const MeshData> data;
+        PendingMesh loading;    // valid while a load is in flight
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> meshes;
+    size_t loads{ 0 };
+    size_t hits{ 0 };
+
+    GeometryCache() {}
+public:
+    static GeometryCache& instance();
+
+    // returns the shared data for filename, loading it (from its mesh cache
+    // or the OBJ) if this is the first reference; empty data if the file is
+    // unusable
+    std::shared_ptr<const MeshData> getMesh(const std::string& filename);
+
+    // like getMesh(), but loads on pool and returns at once; every request
+    // for a file that is already loading waits on that one load
+    PendingMesh requestMesh(const std::string& filename, ThreadPool& pool);
+
+    size_t getLoads() const { std::lock_guard<std::mutex> lock(mutex); return loads; }
+    size_t getHits() const { std::lock_guard<std::mutex> lock(mutex); return hits; }
+};
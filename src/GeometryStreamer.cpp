@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+#include "GeometryStreamer.h"
+#include "AllocationCounter.h"
+#include "GeometryCache.h"
+
+thread_local bool GeometryStreamer::stalled = false;
+
+GeometryStreamer& GeometryStreamer::instance()
+{
+    static GeometryStreamer streamer;
+    return streamer;
+}
+
+void GeometryStreamer::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    if (budget > 0 && !pool)
+    {
+        pool.reset(new ThreadPool(0));
+    }
+}
+
+StreamedGeometry* GeometryStreamer::getGeometry(const std::string& filename)
+{
+    std::error_code ec;
+    std::string path = std::filesystem::weakly_canonical(filename, ec).string();
+    if (ec)
+    {
+        path = filename;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<StreamedGeometry>& g = geometry[path];
+    if (!g)
+    {
+        std::unique_ptr<StreamedGeometry> entry(new StreamedGeometry());
+        entry->filename = filename;
+        entry->bounds = BVHNode{};
+        if (!loadMeshCacheBounds(filename, entry->bounds.boundsMin, entry->bounds.boundsMax, entry->bytes))
+        {
+            geometry.erase(path);
+            return nullptr;
+        }
+        g = std::move(entry);
+    }
+    return g.get();
+}
+
+void GeometryStreamer::request(StreamedGeometry& g)
+{
+    if (g.requested.exchange(true))
+    {
+        return;
+    }
+    // queueing allocates; it happens once per load, not per ray
+    AllocationCounter::Allow allow;
+    std::lock_guard<std::mutex> lock(mutex);
+    // a load requested this round survives the next sync()
+    g.lastUsed = clock.load();
+    if (roundLoads > 0 && used + queued + g.bytes > budget)
+    {
+        // tried again after sync() has made room for it
+        refused.push_back(&g);
+        refusedBytes += g.bytes;
+        return;
+    }
+    roundLoads++;
+    queued += g.bytes;
+    pending++;
+    StreamedGeometry* entry = &g;
+    pool->submit([this, entry]()
+    {
+        std::shared_ptr<const MeshData> data = GeometryCache::instance().getMesh(entry->filename);
+        std::lock_guard<std::mutex> lock(mutex);
+        entry->data = data;
+        entry->resident.store(data.get(), std::memory_order_release);
+        resident.push_back(entry);
+        queued -= entry->bytes;
+        used += entry->bytes;
+        loads++;
+        pending--;
+        loaded.notify_all();
+    });
+}
+
+void GeometryStreamer::sync()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (budget == 0)
+    {
+        return;
+    }
+    loaded.wait(lock, [this]() { return pending == 0; });
+
+    // leave room for what this round had to refuse, so the tiles that
+    // wanted it can load it next round
+    const size_t target = budget - std::min(budget, refusedBytes);
+    const uint64_t now = clock.load();
+    while (used > target)
+    {
+        // least recently used first; linear, there are few resident meshes
+        size_t oldest = resident.size();
+        for (size_t i = 0; i < resident.size(); i++)
+        {
+            if (resident[i]->lastUsed < now &&
+                (oldest == resident.size() || resident[i]->lastUsed < resident[oldest]->lastUsed))
+            {
+                oldest = i;
+            }
+        }
+        if (oldest == resident.size())
+        {
+            break;
+        }
+        StreamedGeometry* g = resident[oldest];
+        g->resident.store(nullptr, std::memory_order_relaxed);
+        g->data.reset();
+        g->requested = false;
+        used -= g->bytes;
+        evictions++;
+        resident[oldest] = resident.back();
+        resident.pop_back();
+    }
+    for (StreamedGeometry* g : refused)
+    {
+        g->requested = false;
+    }
+    refused.clear();
+    refusedBytes = 0;
+    roundLoads = 0;
+    clock++;
+}
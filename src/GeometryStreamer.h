@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BVH.h"
+#include "MeshCache.h"
+#include "ThreadPool.h"
+
+// One mesh file as the streamer sees it: its bounds, known up front from
+// the mesh cache header, and its data once it has been loaded.
+struct StreamedGeometry
+{
+    std::string filename;
+    BVHNode bounds;
+    size_t bytes{ 0 };
+    // what rays read: published by the load, cleared only by an eviction
+    // between render rounds
+    std::atomic<const MeshData*> resident{ nullptr };
+    // a load was queued, or refused this round
+    std::atomic<bool> requested{ false };
+    std::atomic<uint64_t> lastUsed{ 0 };
+    std::shared_ptr<const MeshData> data;
+};
+
+// Process-wide on-demand loader for mesh geometry under a memory budget.
+//
+// With a budget set, the parser turns each TriangleMesh whose mesh cache is
+// up to date into a LazyMesh that only knows its bounds. The first ray to
+// enter those bounds queues a load on the streamer's pool and is marked
+// stalled instead of waiting; the renderer drops the stalled sample, moves
+// on, and retries the tile after sync(). A round only queues loads that fit
+// next to the resident geometry, plus its first load, so a tile needing
+// more than the budget still gets somewhere; the rest are refused and
+// requested again next round. sync() waits for the queued loads and then
+// evicts the least recently used geometry until the refused loads fit too.
+// Geometry used since the previous sync() is never evicted, so the renderer
+// keeps rounds small (a few tiles per thread) and the budget only stretches
+// when one round's geometry doesn't fit in it.
+class GeometryStreamer
+{
+    mutable std::mutex mutex;
+    std::condition_variable loaded;
+    std::unordered_map<std::string, std::unique_ptr<StreamedGeometry>> geometry;
+    std::vector<StreamedGeometry*> resident;
+    std::unique_ptr<ThreadPool> pool;
+    size_t budget{ 0 };
+    size_t used{ 0 };
+    int pending{ 0 };
+    size_t queued{ 0 };                 // bytes of the pending loads
+    int roundLoads{ 0 };                // loads queued since the last sync()
+    std::vector<StreamedGeometry*> refused;
+    size_t refusedBytes{ 0 };
+    size_t loads{ 0 };
+    size_t evictions{ 0 };
+    std::atomic<uint64_t> clock{ 1 };
+
+    static thread_local bool stalled;
+
+    GeometryStreamer() {}
+public:
+    static GeometryStreamer& instance();
+
+    // a budget of 0 (the default) turns streaming off, meshes load eagerly
+    void setBudget(size_t bytes);
+    bool isEnabled() const { std::lock_guard<std::mutex> lock(mutex); return budget > 0; }
+    size_t getUsed() const { std::lock_guard<std::mutex> lock(mutex); return used; }
+    size_t getLoads() const { std::lock_guard<std::mutex> lock(mutex); return loads; }
+    size_t getEvictions() const { std::lock_guard<std::mutex> lock(mutex); return evictions; }
+
+    // the streamed entry for filename, or nullptr if it has no up to date
+    // mesh cache to take the bounds from
+    StreamedGeometry* getGeometry(const std::string& filename);
+
+    // marks the geometry used in the current round
+    void touch(StreamedGeometry& g)
+    {
+        uint64_t now = clock.load(std::memory_order_relaxed);
+        if (g.lastUsed.load(std::memory_order_relaxed) != now)
+        {
+            g.lastUsed.store(now, std::memory_order_relaxed);
+        }
+    }
+
+    // queues a load unless one is already queued or done, or the budget is
+    // full for this round
+    void request(StreamedGeometry& g);
+
+    // waits for the queued loads, makes room for the refused ones and starts
+    // a new round; call it only while no ray is being traced
+    void sync();
+
+    // set by a ray that needed geometry that isn't loaded yet
+    static void markStalled() { stalled = true; }
+    // whether this thread's last trace stalled, clearing the flag
+    static bool takeStalled()
+    {
+        bool result = stalled;
+        stalled = false;
+        return result;
+    }
+};
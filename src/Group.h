@@ -1,7 +1,7 @@
 #pragma once
 
+#include <cassert>
 #include <glm/glm.hpp>
-#include <vector>
 
 #include "Object3D.h"
 #include "Ray.h"
@@ -10,16 +10,19 @@
 class Group : public Object3D
 {
 	int numObjects{ 0 };
-	std::vector<Object3D*> objects;
+	int capacity{ 0 };
+	Object3D** objects{ nullptr };
 public:
 	Group() = delete;
-	Group(int nobjs) { numObjects = nobjs; }
+	// objects has room for nobjs pointers and lives as long as the group
+	// (the scene arena hands both out)
+	Group(int nobjs, Object3D** objects) : capacity(nobjs), objects(objects) {}
 
 	void addObject(int index, Object3D* obj)
 	{
 		// right now, we don't use index anywhere
-		objects.push_back(obj);
-		numObjects++;
+		assert(numObjects < capacity);
+		objects[numObjects++] = obj;
 	}
 
 	int getGroupSize() { return numObjects; }
@@ -27,10 +30,20 @@ public:
 	virtual bool intersect(const Ray& ray, Hit& hit, float tmin)
 	{
 		bool isIntersected = false;
-		for (auto objPtr : objects)
+		for (int i = 0; i < numObjects; i++)
 		{
-			isIntersected = isIntersected || objPtr->intersect(ray, hit, tmin);
+			Object3D* objPtr = objects[i];
+			// every object has to be tried, a later one may be closer
+			isIntersected = objPtr->intersect(ray, hit, tmin) || isIntersected;
 		}
 		return isIntersected;
 	}
+
+	virtual void intersectBatch(const Ray* rays, Hit* hits, bool* results, int count, float tmin)
+	{
+		for (int i = 0; i < numObjects; i++)
+		{
+			objects[i]->intersectBatch(rays, hits, results, count, tmin);
+		}
+	}
 };
\ No newline at end of file
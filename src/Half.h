@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#define HALF_USE_F16C
+#endif
+
+// IEEE 754 half precision floats, as stored in half images and EXR files.
+// Rounds to nearest even; values past 65504 become infinity, NaN stays NaN.
+
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t x;
+    memcpy(&x, &value, 4);
+    const uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+    uint32_t h;
+    if (x >= 0x47800000u)
+    {
+        // too large for a half, or already infinite / NaN
+        h = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+    }
+    else if (x < 0x38800000u)
+    {
+        // denormal result: adding 0.5 lines the 10 mantissa bits up at the
+        // bottom of the float and lets the FPU do the rounding
+        float f;
+        const uint32_t magic = 0x3f000000u;
+        memcpy(&f, &x, 4);
+        float m;
+        memcpy(&m, &magic, 4);
+        f += m;
+        memcpy(&h, &f, 4);
+        h -= magic;
+    }
+    else
+    {
+        // rebias the exponent and round the 13 dropped bits to even
+        const uint32_t odd = (x >> 13) & 1;
+        x += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+        h = x >> 13;
+    }
+    return (uint16_t)(h | (sign >> 16));
+}
+
+inline float halfToFloat(uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    const uint32_t mantissa = h & 0x3ff;
+    uint32_t x;
+    if (exponent == 0)
+    {
+        // zero or denormal, exactly mantissa * 2^-24
+        float f = mantissa * (1.0f / 16777216.0f);
+        memcpy(&x, &f, 4);
+        x |= sign;
+    }
+    else if (exponent == 31)
+    {
+        x = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else
+    {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+inline void floatsToHalves(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef HALF_USE_F16C
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i h = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storel_epi64((__m128i*)(dst + i), h);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
+
+inline void halvesToFloats(const uint16_t* src, float* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef HALF_USE_F16C
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(dst + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i))));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i] = halfToFloat(src[i]);
+    }
+}
@@ -11,6 +11,7 @@ class Hit
 	float t{std::numeric_limits<float>::max()};
 	bool hasTex{ false };
 	glm::vec2 texCoord;
+	float texFootprint{ 0.0f };
 	Material* material{nullptr};
 	glm::vec3 normal;
 
@@ -27,6 +28,7 @@ public:
 		if (hit.isTexDefined())
 		{
 			texCoord = hit.texCoord;
+			texFootprint = hit.texFootprint;
 			hasTex = true;
 		}
 	}
@@ -39,9 +41,12 @@ public:
 	}
 
 
-	void setTexCoord(const glm::vec2& tcoord)
+	// footprint is the width of the ray's footprint in texture space, if
+	// the primitive can estimate it; it picks the texture's mip level
+	void setTexCoord(const glm::vec2& tcoord, float footprint = 0.0f)
 	{
 		texCoord = tcoord;
+		texFootprint = footprint;
 		hasTex = true;
 	}
 
@@ -50,6 +55,7 @@ public:
 	glm::vec3 getNormal() const { return normal; }
 	bool isTexDefined() const { return hasTex; }
 	glm::vec2 getTexCoord() const { return texCoord; }
+	float getTexFootprint() const { return texFootprint; }
 };
 
 inline std::ostream& operator << (std::ostream& os, const Hit& h)
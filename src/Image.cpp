@@ -1,327 +1,228 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 
 #include "Image.h"
+#include "ImageCompare.h"
+#include "ImageFormats.h"
+#include "Parallel.h"
 
 // some helper functions for save & load
 
-unsigned char ReadByte(FILE* file)
+// the whole file goes out in one write, next to the real file and renamed
+// over it, so a reader watching filename (a progressive preview) never
+// sees half an image
+static bool WriteFile(const std::string& filename, const std::vector<unsigned char>& bytes)
 {
-    unsigned char b;
-    int success = fread((void*)(&b), sizeof(unsigned char), 1, file);
-    assert(success == 1);
-    return b;
-}
-
-void WriteByte(FILE* file, unsigned char b)
-{
-    int success = fwrite((void*)(&b), sizeof(unsigned char), 1, file);
-    assert(success == 1);
-}
-
-unsigned char ClampColorComponent(float c)
-{
-    int tmp = int(c * 255);
-
-    if (tmp < 0)
+    const std::string temporary = filename + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == NULL)
     {
-        tmp = 0;
+        std::cerr << "can't write " << filename << std::endl;
+        return false;
     }
-
-    if (tmp > 255)
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = fclose(file) == 0 && ok;
+    // rename() won't replace an existing file everywhere
+    if (ok && std::rename(temporary.c_str(), filename.c_str()) != 0)
     {
-        tmp = 255;
+        std::remove(filename.c_str());
+        ok = std::rename(temporary.c_str(), filename.c_str()) == 0;
     }
+    if (!ok)
+    {
+        std::cerr << "error writing " << filename << std::endl;
+        std::remove(temporary.c_str());
+    }
+    return ok;
+}
 
-    return (unsigned char)tmp;
+// quantizes every row into out, rowStride bytes apart; topDown puts the
+// top row (y = height - 1) first. Blocks of rows go to separate threads.
+void Image::EncodeRows(const QuantizeSettings& settings, bool bgr, bool topDown, unsigned char* out, size_t rowStride) const
+{
+    const Quantizer quantizer(settings);
+    const int rowsPerBlock = 64;
+    const int blocks = (height + rowsPerBlock - 1) / rowsPerBlock;
+    parallelFor(blocks, 0, [&](int block)
+    {
+        std::vector<float> scratch(IsHalf() ? (size_t)width * 3 : 0);
+        int end = std::min(height, (block + 1) * rowsPerBlock);
+        for (int y = block * rowsPerBlock; y < end; y++)
+        {
+            size_t fileRow = topDown ? height - 1 - y : y;
+            quantizer.quantizeRow(Row(y, scratch.data()), width, y, bgr, out + fileRow * rowStride);
+        }
+    });
 }
 
 // Save and Load data type 2 Targa (.tga) files
 // (uncompressed, unmapped RGB images)
 
-void Image::SaveTGA(const std::string& filename) const
+void Image::SaveTGA(const std::string& filename, const QuantizeSettings& settings) const
 {
     assert(filename.size() != 0);
     // must end in .tga
     std::string ext = filename.substr(filename.size() - 4, 4);
-    assert(ext != ".tga");
-    FILE* file = fopen(filename.c_str(), "wb");
+    assert(ext == ".tga");
     // misc header information
-    for (int i = 0; i < 18; i++)
-    {
-        if (i == 2) WriteByte(file, 2);
-        else if (i == 12) WriteByte(file, width % 256);
-        else if (i == 13) WriteByte(file, width / 256);
-        else if (i == 14) WriteByte(file, height % 256);
-        else if (i == 15) WriteByte(file, height / 256);
-        else if (i == 16) WriteByte(file, 24);
-        else if (i == 17) WriteByte(file, 32);
-        else WriteByte(file, 0);
-    }
-    // the data
+    std::vector<unsigned char> bytes = encodeTGAHeader(width, height);
+    size_t headerSize = bytes.size();
+    bytes.resize(headerSize + (size_t)width * height * 3);
+    // the data, b, g, r
     // flip y so that (0,0) is bottom left corner
-    for (int y = height - 1; y >= 0; y--)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            glm::vec3 v = GetPixel(x, y);
-            // note reversed order: b, g, r
-            WriteByte(file, ClampColorComponent(v[2]));
-            WriteByte(file, ClampColorComponent(v[1]));
-            WriteByte(file, ClampColorComponent(v[0]));
-        }
-    }
-    fclose(file);
+    EncodeRows(settings, true, true, &bytes[headerSize], (size_t)width * 3);
+    WriteFile(filename, bytes);
 }
 
 Image* Image::LoadTGA(const std::string& filename) {
-    assert(filename.size() != 0);
-    // must end in .tga
-    const std::string ext = filename.substr(filename.size() - 4, 4);
-    assert(ext != ".tga");
-    FILE* file = fopen(filename.c_str(), "rb");
-    // misc header information
-    int width = 0;
-    int height = 0;
-    for (int i = 0; i < 18; i++) {
-        unsigned char tmp;
-        tmp = ReadByte(file);
-        if (i == 2) assert(tmp == 2);
-        else if (i == 12) width += tmp;
-        else if (i == 13) width += 256 * tmp;
-        else if (i == 14) height += tmp;
-        else if (i == 15) height += 256 * tmp;
-        else if (i == 16) assert(tmp == 24);
-        else if (i == 17) assert(tmp == 32);
-        else assert(tmp == 0);
-    }
-    // the data
-    Image* answer = new Image(width, height);
-    // flip y so that (0,0) is bottom left corner
-    for (int y = height - 1; y >= 0; y--) {
-        for (int x = 0; x < width; x++) {
-            unsigned char r, g, b;
-            // note reversed order: b, g, r
-            b = ReadByte(file);
-            g = ReadByte(file);
-            r = ReadByte(file);
-            glm::vec3 color(r / 255.0, g / 255.0, b / 255.0);
-            answer->SetPixel(x, y, color);
-        }
-    }
-    fclose(file);
-    return answer;
+    return LoadMapped(filename, parseTGAHeader);
 }
 
-// Save and Load PPM image files using magic number 'P6' 
-// and having one comment line
+// Save and Load PPM image files using magic number 'P6'
+// (saved with one comment line, loaded with any number)
 
-void Image::SavePPM(const char* filename) const {
+void Image::SavePPM(const char* filename, const QuantizeSettings& settings) const {
     assert(filename != NULL);
     // must end in .ppm
     const char* ext = &filename[strlen(filename) - 4];
     assert(!strcmp(ext, ".ppm"));
-    FILE* file = fopen(filename, "w");
     // misc header information
-    assert(file != NULL);
-    fprintf(file, "P6\n");
-    fprintf(file, "# Creator: Image::SavePPM()\n");
-    fprintf(file, "%d %d\n", width, height);
-    fprintf(file, "255\n");
+    std::vector<unsigned char> bytes = encodePPMHeader(width, height);
+    size_t headerSize = bytes.size();
+    bytes.resize(headerSize + (size_t)width * height * 3);
     // the data
     // flip y so that (0,0) is bottom left corner
-    for (int y = height - 1; y >= 0; y--) {
-        for (int x = 0; x < width; x++) {
-            glm::vec3 v = GetPixel(x, y);
-            fputc(ClampColorComponent(v[0]), file);
-            fputc(ClampColorComponent(v[1]), file);
-            fputc(ClampColorComponent(v[2]), file);
-        }
-    }
-    fclose(file);
+    EncodeRows(settings, false, true, &bytes[headerSize], (size_t)width * 3);
+    WriteFile(filename, bytes);
 }
 
 Image* Image::LoadPPM(const char* filename) {
-    assert(filename != NULL);
-    // must end in .ppm
-    const char* ext = &filename[strlen(filename) - 4];
-    assert(!strcmp(ext, ".ppm"));
-    FILE* file = fopen(filename, "rb");
-    // misc header information
-    int width = 0;
-    int height = 0;
-    char tmp[100];
-    fgets(tmp, 100, file);
-    assert(strstr(tmp, "P6"));
-    fgets(tmp, 100, file);
-    assert(tmp[0] == '#');
-    fgets(tmp, 100, file);
-    sscanf(tmp, "%d %d", &width, &height);
-    fgets(tmp, 100, file);
-    assert(strstr(tmp, "255"));
-    // the data
-    Image* answer = new Image(width, height);
-    // flip y so that (0,0) is bottom left corner
-    for (int y = height - 1; y >= 0; y--) {
-        for (int x = 0; x < width; x++) {
-            unsigned char r, g, b;
-            r = fgetc(file);
-            g = fgetc(file);
-            b = fgetc(file);
-            glm::vec3 color(r / 255.0, g / 255.0, b / 255.0);
-            answer->SetPixel(x, y, color);
-        }
+    return LoadMapped(filename, parsePPMHeader);
+}
+
+Image* Image::LoadBMP(const std::string& filename)
+{
+    return LoadMapped(filename, parseBMPHeader);
+}
+
+// maps the file, validates the header once and converts whole rows straight
+// into the pixel array; returns NULL if the file can't be read
+Image* Image::LoadMapped(const std::string& filename,
+                         bool (*parseHeader)(const MappedFile&, const std::string&, PixelLayout&))
+{
+    MappedFile file;
+    PixelLayout layout;
+    if (!file.open(filename, MappedFile::Sequential) || !parseHeader(file, filename, layout))
+    {
+        return NULL;
+    }
+    Image* answer = new Image(layout.width, layout.height);
+    // (0,0) is the bottom left corner, the layout counts rows from the top
+    for (int y = 0; y < layout.height; y++)
+    {
+        float* row = &answer->data[(size_t)(layout.height - 1 - y) * layout.width][0];
+        convertRowToRGB(layout.row(file, y), layout, row);
     }
-    fclose(file);
     return answer;
 }
 
-Image* Image::compare(Image* img1, Image* img2) {
-    assert(img1->Width() == img2->Width());
-    assert(img1->Height() == img2->Height());
-
+Image* Image::compare(Image* img1, Image* img2, ImageError* error) {
     Image* img3 = new Image(img1->Width(), img1->Height());
-
-    for (int x = 0; x < img1->Width(); x++) {
-        for (int y = 0; y < img1->Height(); y++) {
-            glm::vec3 color1 = img1->GetPixel(x, y);
-            glm::vec3 color2 = img2->GetPixel(x, y);
-            glm::vec3 color3 =
-                glm::vec3
-                (
-                    fabs(color1[0] - color2[0]),
-                    fabs(color1[1] - color2[1]),
-                    fabs(color1[2] - color2[2])
-                );
-            img3->SetPixel(x, y, color3);
-        }
+    ImageError result = compareImages(*img1, *img2, CompareSettings(), img3);
+    if (error != NULL) {
+        *error = result;
     }
-
     return img3;
 }
-/****************************************************************************
-    bmp.c - read and write bmp images.
-    Distributed with Xplanet.
-    Copyright (C) 2002 Hari Nair <hari@alumni.caltech.edu>
-
-    This program is free software; you can redistribute it and/or modify
-    it under the terms of the GNU General Public License as published by
-    the Free Software Foundation; either version 2 of the License, or
-    (at your option) any later version.
-
-    This program is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-    GNU General Public License for more details.
 
-    You should have received a copy of the GNU General Public License
-    along with this program; if not, write to the Free Software
-    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
-****************************************************************************/
-struct BMPHeader
+int Image::SaveBMP(const std::string& filename, const QuantizeSettings& settings) const
 {
-    char bfType[3];       /* "BM" */
-    int bfSize;           /* Size of file in bytes */
-    int bfReserved;       /* set to 0 */
-    int bfOffBits;        /* Byte offset to actual bitmap data (= 54) */
-    int biSize;           /* Size of BITMAPINFOHEADER, in bytes (= 40) */
-    int biWidth;          /* Width of image, in pixels */
-    int biHeight;         /* Height of images, in pixels */
-    short biPlanes;       /* Number of planes in target device (set to 1) */
-    short biBitCount;     /* Bits per pixel (24 in this case) */
-    int biCompression;    /* Type of compression (0 if no compression) */
-    int biSizeImage;      /* Image size, in bytes (0 if no compression) */
-    int biXPelsPerMeter;  /* Resolution in pixels/meter of display device */
-    int biYPelsPerMeter;  /* Resolution in pixels/meter of display device */
-    int biClrUsed;        /* Number of colors in the color table (if 0, use
-                             maximum allowed by biBitCount) */
-    int biClrImportant;   /* Number of important colors.  If 0, all colors
-                             are important */
-};
+    std::vector<unsigned char> bytes = encodeBMPHeader(width, height, false);
+    size_t headerSize = bytes.size();
+    // the padding at the end of each line stays 0
+    size_t bytesPerLine = bmpRowStride(width);
+    bytes.resize(headerSize + bytesPerLine * height);
+    // bottom up, like the pixels
+    EncodeRows(settings, true, false, &bytes[headerSize], bytesPerLine);
+    return WriteFile(filename, bytes) ? 1 : 0;
+}
 
-int Image::SaveBMP(const std::string& filename)
+void Image::SavePFM(const std::string& filename) const
 {
-    int i, j, ipos;
-    int bytesPerLine;
-    unsigned char* line;
-    glm::vec3* rgb = data;
-    FILE* file;
-    struct BMPHeader bmph;
-
-    /* The length of each line must be a multiple of 4 bytes */
-
-    bytesPerLine = (3 * (width + 1) / 4) * 4;
-
-    strcpy(bmph.bfType, "BM");
-    bmph.bfOffBits = 54;
-    bmph.bfSize = bmph.bfOffBits + bytesPerLine * height;
-    bmph.bfReserved = 0;
-    bmph.biSize = 40;
-    bmph.biWidth = width;
-    bmph.biHeight = height;
-    bmph.biPlanes = 1;
-    bmph.biBitCount = 24;
-    bmph.biCompression = 0;
-    bmph.biSizeImage = bytesPerLine * height;
-    bmph.biXPelsPerMeter = 0;
-    bmph.biYPelsPerMeter = 0;
-    bmph.biClrUsed = 0;
-    bmph.biClrImportant = 0;
-
-    file = fopen(filename.c_str(), "wb");
-    if (file == NULL) return(0);
-
-    fwrite(&bmph.bfType, 2, 1, file);
-    fwrite(&bmph.bfSize, 4, 1, file);
-    fwrite(&bmph.bfReserved, 4, 1, file);
-    fwrite(&bmph.bfOffBits, 4, 1, file);
-    fwrite(&bmph.biSize, 4, 1, file);
-    fwrite(&bmph.biWidth, 4, 1, file);
-    fwrite(&bmph.biHeight, 4, 1, file);
-    fwrite(&bmph.biPlanes, 2, 1, file);
-    fwrite(&bmph.biBitCount, 2, 1, file);
-    fwrite(&bmph.biCompression, 4, 1, file);
-    fwrite(&bmph.biSizeImage, 4, 1, file);
-    fwrite(&bmph.biXPelsPerMeter, 4, 1, file);
-    fwrite(&bmph.biYPelsPerMeter, 4, 1, file);
-    fwrite(&bmph.biClrUsed, 4, 1, file);
-    fwrite(&bmph.biClrImportant, 4, 1, file);
-
-    line = (unsigned char*)malloc(bytesPerLine);
-    if (line == NULL)
+    std::vector<unsigned char> bytes = encodePFMHeader(width, height);
+    size_t headerSize = bytes.size();
+    size_t rowBytes = (size_t)width * 3 * sizeof(float);
+    bytes.resize(headerSize + rowBytes * height);
+    // bottom row first like the pixels; assumes a little endian host
+    std::vector<float> scratch((size_t)width * 3);
+    for (int y = 0; y < height; y++)
     {
-        fprintf(stderr, "Can't allocate memory for BMP file.\n");
-        return(0);
+        memcpy(&bytes[headerSize + y * rowBytes], Row(y, scratch.data()), rowBytes);
     }
+    WriteFile(filename, bytes);
+}
 
-    for (i = 0; i < height; i++)
+void Image::SaveEXR(const std::string& filename, bool halfFloat) const
+{
+    std::vector<unsigned char> bytes = encodeEXRHeader(width, height, halfFloat);
+    size_t headerSize = bytes.size();
+    size_t lineBytes = exrScanlineSize(width, halfFloat);
+    bytes.resize(headerSize + lineBytes * height);
+    // line 0 is the top row
+    std::vector<float> scratch((size_t)width * 3);
+    for (int line = 0; line < height; line++)
     {
-        for (j = 0; j < width; j++)
-        {
-            ipos = (width * i + j);
-            line[3 * j] = ClampColorComponent(rgb[ipos][2]);
-            line[3 * j + 1] = ClampColorComponent(rgb[ipos][1]);
-            line[3 * j + 2] = ClampColorComponent(rgb[ipos][0]);
-        }
-        fwrite(line, bytesPerLine, 1, file);
+        encodeEXRScanline(Row(height - 1 - line, scratch.data()), width, line, halfFloat, &bytes[headerSize + line * lineBytes]);
     }
-
-    free(line);
-    fclose(file);
-
-    return(1);
+    WriteFile(filename, bytes);
 }
 
-void Image::SaveImage(const std::string& filename)
+Image* Image::Load(const std::string& filename)
 {
     assert(filename.size() > 4);
     const std::string ext = filename.substr(filename.size() - 4, 4);
+    if (ext == ".ppm")
+    {
+        return LoadPPM(filename.c_str());
+    }
     if (ext == ".bmp")
     {
-        SaveBMP(filename);
+        return LoadBMP(filename);
+    }
+    return LoadTGA(filename);
+}
+
+void Image::SaveImage(const std::string& filename, const QuantizeSettings& settings) const
+{
+    const std::string ext = filename.size() >= 4 ? filename.substr(filename.size() - 4, 4) : std::string();
+    if (ext == ".tga")
+    {
+        SaveTGA(filename, settings);
+    }
+    else if (ext == ".bmp")
+    {
+        SaveBMP(filename, settings);
+    }
+    else if (ext == ".ppm")
+    {
+        SavePPM(filename.c_str(), settings);
+    }
+    else if (ext == ".pfm")
+    {
+        SavePFM(filename);
+    }
+    else if (ext == ".exr")
+    {
+        SaveEXR(filename);
     }
     else
     {
-        SaveTGA(filename);
+        std::cerr << "can't write " << filename << ": unknown image format (use .tga, .bmp, .ppm, .pfm or .exr)" << std::endl;
     }
-}
\ No newline at end of file
+}
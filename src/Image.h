@@ -1,22 +1,35 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <string>
 
+#include "Half.h"
+#include "ImageFormats.h"
+
+struct ImageError;
+
 // Simple image class
 class Image
 {
 
 public:
 
-    Image(int w, int h)
+    // a halfFloat image stores its pixels as half precision floats, half
+    // the memory of a float image while keeping values above 1
+    Image(int w, int h, bool halfFloat = false)
     {
         width = w;
         height = h;
-        data = new glm::vec3[width * height];
+        data = halfFloat ? nullptr : new glm::vec3[width * height];
+        halfData = halfFloat ? new uint16_t[(size_t)width * height * 3]() : nullptr;
     }
 
     ~Image()
     {
         delete[] data;
+        delete[] halfData;
     }
 
     int Width() const
@@ -29,10 +42,20 @@ public:
         return height;
     }
 
-    const glm::vec3& GetPixel(int x, int y) const
+    bool IsHalf() const
+    {
+        return halfData != nullptr;
+    }
+
+    glm::vec3 GetPixel(int x, int y) const
     {
         assert(x >= 0 && x < width);
         assert(y >= 0 && y < height);
+        if (halfData != nullptr)
+        {
+            const uint16_t* p = &halfData[((size_t)y * width + x) * 3];
+            return glm::vec3(halfToFloat(p[0]), halfToFloat(p[1]), halfToFloat(p[2]));
+        }
         return data[y * width + x];
     }
 
@@ -40,7 +63,7 @@ public:
     {
         for (int i = 0; i < width * height; ++i)
         {
-            data[i] = color;
+            SetPixel(i % width, i / width, color);
         }
     }
 
@@ -48,23 +71,60 @@ public:
     {
         assert(x >= 0 && x < width);
         assert(y >= 0 && y < height);
+        if (halfData != nullptr)
+        {
+            uint16_t* p = &halfData[((size_t)y * width + x) * 3];
+            p[0] = floatToHalf(color[0]);
+            p[1] = floatToHalf(color[1]);
+            p[2] = floatToHalf(color[2]);
+            return;
+        }
         data[y * width + x] = color;
     }
 
+    // row y as r, g, b floats; points into the image for float images,
+    // half images are converted into scratch, which needs 3 * width floats
+    const float* Row(int y, float* scratch) const
+    {
+        assert(y >= 0 && y < height);
+        if (halfData != nullptr)
+        {
+            halvesToFloats(&halfData[(size_t)y * width * 3], scratch, (size_t)width * 3);
+            return scratch;
+        }
+        return &data[(size_t)y * width][0];
+    }
+
+    // the savers quantize with settings, see ImageFormats.h
     static Image* LoadPPM(const char* filename);
-    void SavePPM(const char* filename) const;
+    void SavePPM(const char* filename, const QuantizeSettings& settings = QuantizeSettings()) const;
 
     static Image* LoadTGA(const std::string& filename);
-    void SaveTGA(const std::string& filename) const;
-    int SaveBMP(const std::string& filename);
-    void SaveImage(const std::string& filename);
-    // extension for image comparison
-    static Image* compare(Image* img1, Image* img2);
+    static Image* LoadBMP(const std::string& filename);
+    void SaveTGA(const std::string& filename, const QuantizeSettings& settings = QuantizeSettings()) const;
+    int SaveBMP(const std::string& filename, const QuantizeSettings& settings = QuantizeSettings()) const;
+    // floating point outputs, nothing is clamped; PFM is always 32 bit,
+    // EXR is written as half floats unless halfFloat is false
+    void SavePFM(const std::string& filename) const;
+    void SaveEXR(const std::string& filename, bool halfFloat = true) const;
+    // picks the writer from the extension, .tga, .bmp, .ppm, .pfm or .exr;
+    // any other name is reported and nothing is written
+    void SaveImage(const std::string& filename, const QuantizeSettings& settings = QuantizeSettings()) const;
+    // picks the loader from the extension, .ppm, .bmp or .tga
+    static Image* Load(const std::string& filename);
+    // extension for image comparison, optionally also reporting error
+    // metrics; see compareImages() in ImageCompare.h for the full version
+    static Image* compare(Image* img1, Image* img2, ImageError* error = nullptr);
 
 private:
 
+    static Image* LoadMapped(const std::string& filename,
+                             bool (*parseHeader)(const MappedFile&, const std::string&, PixelLayout&));
+    void EncodeRows(const QuantizeSettings& settings, bool bgr, bool topDown, unsigned char* out, size_t rowStride) const;
+
     int width;
     int height;
     glm::vec3 *data;
+    uint16_t *halfData;     // r, g, b per pixel, instead of data
 
 };
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IMAGECOMPARE_USE_SSE
+#endif
+
+#include "ImageCompare.h"
+#include "Framebuffer.h"
+#include "Parallel.h"
+
+namespace
+{
+    const int Window = 8;
+
+    // running sums over one SSIM window
+    struct WindowSums
+    {
+        double x{ 0 }, y{ 0 }, xx{ 0 }, yy{ 0 }, xy{ 0 };
+        int n{ 0 };
+
+        double ssim() const
+        {
+            const double c1 = 0.01 * 0.01;
+            const double c2 = 0.03 * 0.03;
+            double mx = x / n;
+            double my = y / n;
+            double vx = xx / n - mx * mx;
+            double vy = yy / n - my * my;
+            double cxy = xy / n - mx * my;
+            return ((2 * mx * my + c1) * (2 * cxy + c2)) / ((mx * mx + my * my + c1) * (vx + vy + c2));
+        }
+    };
+
+    struct BandResult
+    {
+        double squaredSum{ 0 };
+        double ssimSum{ 0 };
+        long long windows{ 0 };
+        float maxError{ 0 };
+        long long failed{ 0 };
+    };
+
+    // absolute differences of n floats into out; returns the sum of their
+    // squares and raises maxError
+    double diffRow(const float* a, const float* b, int n, float* out, float& maxError)
+    {
+        int i = 0;
+        double sum = 0.0;
+#ifdef IMAGECOMPARE_USE_SSE
+        const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 squares = _mm_setzero_ps();
+        __m128 maxima = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 d = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), signMask);
+            _mm_storeu_ps(out + i, d);
+            squares = _mm_add_ps(squares, _mm_mul_ps(d, d));
+            maxima = _mm_max_ps(maxima, d);
+        }
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, squares);
+        sum = (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_store_ps(lanes, maxima);
+        maxError = std::max(maxError, std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3])));
+#endif
+        for (; i < n; i++)
+        {
+            float d = fabsf(a[i] - b[i]);
+            out[i] = d;
+            sum += (double)d * d;
+            maxError = std::max(maxError, d);
+        }
+        return sum;
+    }
+}
+
+ImageError compareImages(const Image& a, const Image& b, const CompareSettings& settings, Image* diff, Image* mask)
+{
+    assert(a.Width() == b.Width() && a.Height() == b.Height());
+    const int width = a.Width();
+    const int height = a.Height();
+    const int bands = (height + Window - 1) / Window;
+    std::vector<BandResult> results(bands);
+
+    parallelFor(bands, settings.threads, [&](int band)
+    {
+        BandResult& result = results[band];
+        std::vector<float> rowA((size_t)width * 3);
+        std::vector<float> rowB((size_t)width * 3);
+        std::vector<float> delta((size_t)width * 3);
+        std::vector<WindowSums> windows((width + Window - 1) / Window);
+
+        const int end = std::min(height, (band + 1) * Window);
+        for (int y = band * Window; y < end; y++)
+        {
+            const float* pa = a.Row(y, rowA.data());
+            const float* pb = b.Row(y, rowB.data());
+            // one row at a time in float keeps the sum accurate enough
+            result.squaredSum += diffRow(pa, pb, width * 3, delta.data(), result.maxError);
+
+            for (int x = 0; x < width; x++)
+            {
+                const float* d = &delta[3 * x];
+                bool failed = std::max(std::max(d[0], d[1]), d[2]) > settings.tolerance;
+                result.failed += failed;
+                if (diff != nullptr)
+                {
+                    diff->SetPixel(x, y, glm::vec3(d[0], d[1], d[2]));
+                }
+                if (mask != nullptr)
+                {
+                    mask->SetPixel(x, y, glm::vec3(failed ? 1.0f : 0.0f));
+                }
+
+                double la = luminance(glm::vec3(pa[3 * x], pa[3 * x + 1], pa[3 * x + 2]));
+                double lb = luminance(glm::vec3(pb[3 * x], pb[3 * x + 1], pb[3 * x + 2]));
+                WindowSums& w = windows[x / Window];
+                w.x += la;
+                w.y += lb;
+                w.xx += la * la;
+                w.yy += lb * lb;
+                w.xy += la * lb;
+                w.n++;
+            }
+        }
+
+        for (const WindowSums& w : windows)
+        {
+            result.ssimSum += w.ssim();
+            result.windows++;
+        }
+    });
+
+    ImageError error;
+    double squaredSum = 0.0;
+    double ssimSum = 0.0;
+    long long windows = 0;
+    for (const BandResult& result : results)
+    {
+        squaredSum += result.squaredSum;
+        ssimSum += result.ssimSum;
+        windows += result.windows;
+        error.maxError = std::max(error.maxError, result.maxError);
+        error.failedPixels += result.failed;
+    }
+    error.mse = squaredSum / (3.0 * width * height);
+    error.rmse = sqrt(error.mse);
+    error.psnr = error.mse > 0.0 ? 10.0 * log10(1.0 / error.mse) : std::numeric_limits<double>::infinity();
+    error.ssim = windows > 0 ? ssimSum / windows : 1.0;
+    return error;
+}
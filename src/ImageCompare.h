@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Image.h"
+
+// summary of how far two images are apart, over all channels
+struct ImageError
+{
+    double mse{ 0.0 };
+    double rmse{ 0.0 };
+    double psnr{ 0.0 };     // dB, peak value 1; infinite for identical images
+    double ssim{ 1.0 };     // mean structural similarity of the luminance
+    float maxError{ 0.0f };
+    long long failedPixels{ 0 };    // pixels with a channel off by more than the tolerance
+};
+
+struct CompareSettings
+{
+    float tolerance{ 1.0f / 255.0f };   // per channel, one 8 bit step by default
+    int threads{ 0 };
+};
+
+// Compares two images of the same size in a single multithreaded pass.
+//
+// Bands of 8 rows go to separate threads; each compares its rows four
+// floats at a time with SSE for the squared error, the maximum error and
+// the tolerance test, and computes SSIM over the band's 8x8 windows (on
+// luminance, non-overlapping, with the usual K1 = 0.01, K2 = 0.03 for a
+// peak of 1). diff, if given, receives the per pixel absolute difference
+// and mask white for pixels over the tolerance; both must have the images'
+// size.
+ImageError compareImages(const Image& a, const Image& b, const CompareSettings& settings,
+                         Image* diff = nullptr, Image* mask = nullptr);
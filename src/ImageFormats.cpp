@@ -0,0 +1,563 @@
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IMAGEFORMATS_USE_SSE
+#endif
+
+#include "Half.h"
+#include "ImageFormats.h"
+
+static unsigned readLE(const unsigned char* p, int bytes)
+{
+    unsigned v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static bool fail(const char* format, const std::string& filename, const char* reason)
+{
+    std::cerr << format << " ERROR: " << filename << ": " << reason << std::endl;
+    return false;
+}
+
+// the pixel rows have to be inside the file, everything after relies on it
+static bool checkExtent(const MappedFile& file, const char* format, const std::string& filename, PixelLayout& layout)
+{
+    if (layout.width <= 0 || layout.height <= 0)
+    {
+        return fail(format, filename, "empty image");
+    }
+    size_t rowBytes = (size_t)layout.width * layout.channels;
+    if (layout.rowStride < rowBytes)
+    {
+        return fail(format, filename, "bad row stride");
+    }
+    // dataOffset + rowStride * (height - 1) + rowBytes can wrap around for
+    // hostile headers, so compare against the space left instead
+    if (layout.dataOffset > file.size() || rowBytes > file.size() - layout.dataOffset)
+    {
+        return fail(format, filename, "file is truncated");
+    }
+    size_t available = file.size() - layout.dataOffset - rowBytes;
+    if (layout.height > 1 && layout.rowStride > available / (size_t)(layout.height - 1))
+    {
+        return fail(format, filename, "file is truncated");
+    }
+    return true;
+}
+
+bool parseBMPHeader(const MappedFile& file, const std::string& filename, PixelLayout& layout)
+{
+    const unsigned char* h = file.data();
+    if (file.size() < 54 || h[0] != 'B' || h[1] != 'M')
+    {
+        return fail("BMP", filename, "not a bitmap");
+    }
+    int bitCount = (int)readLE(h + 28, 2);
+    int compression = (int)readLE(h + 30, 4);
+    if ((bitCount != 24 && bitCount != 32) || compression != 0)
+    {
+        return fail("BMP", filename, "only uncompressed 24 and 32 bit bitmaps are supported");
+    }
+    int height = (int)readLE(h + 22, 4);
+    if (height == INT_MIN)
+    {
+        // has no positive counterpart
+        return fail("BMP", filename, "bad height");
+    }
+    layout.width = (int)readLE(h + 18, 4);
+    // a negative height marks a top down bitmap
+    layout.topDown = height < 0;
+    layout.height = std::abs(height);
+    layout.channels = bitCount / 8;
+    layout.bgr = true;
+    layout.dataOffset = readLE(h + 10, 4);
+    layout.rowStride = ((size_t)layout.channels * layout.width + 3) & ~(size_t)3;
+    return checkExtent(file, "BMP", filename, layout);
+}
+
+bool parseTGAHeader(const MappedFile& file, const std::string& filename, PixelLayout& layout)
+{
+    const unsigned char* h = file.data();
+    if (file.size() < 18 || h[1] != 0 || h[2] != 2)
+    {
+        return fail("TGA", filename, "only uncompressed true colour targas are supported");
+    }
+    int bitCount = h[16];
+    if (bitCount != 24 && bitCount != 32)
+    {
+        return fail("TGA", filename, "only 24 and 32 bit targas are supported");
+    }
+    if (h[17] & 0x10)
+    {
+        return fail("TGA", filename, "right to left targas are not supported");
+    }
+    layout.width = (int)readLE(h + 12, 2);
+    layout.height = (int)readLE(h + 14, 2);
+    layout.channels = bitCount / 8;
+    layout.bgr = true;
+    layout.topDown = (h[17] & 0x20) != 0;
+    // the image id comes straight after the header
+    layout.dataOffset = 18 + (size_t)h[0];
+    layout.rowStride = (size_t)layout.channels * layout.width;
+    return checkExtent(file, "TGA", filename, layout);
+}
+
+// reads the next number of a PPM header, skipping whitespace and comments
+static bool readPPMNumber(const MappedFile& file, size_t& pos, int& value)
+{
+    const unsigned char* p = file.data();
+    while (pos < file.size())
+    {
+        if (p[pos] == '#')
+        {
+            while (pos < file.size() && p[pos] != '\n')
+            {
+                pos++;
+            }
+        }
+        else if (isspace(p[pos]))
+        {
+            pos++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (pos >= file.size() || !isdigit(p[pos]))
+    {
+        return false;
+    }
+    value = 0;
+    while (pos < file.size() && isdigit(p[pos]) && value < (1 << 24))
+    {
+        value = value * 10 + (p[pos++] - '0');
+    }
+    return true;
+}
+
+bool parsePPMHeader(const MappedFile& file, const std::string& filename, PixelLayout& layout)
+{
+    const unsigned char* h = file.data();
+    if (file.size() < 2 || h[0] != 'P' || h[1] != '6')
+    {
+        return fail("PPM", filename, "not a binary (P6) ppm");
+    }
+    size_t pos = 2;
+    int maxValue = 0;
+    if (!readPPMNumber(file, pos, layout.width) || !readPPMNumber(file, pos, layout.height) ||
+        !readPPMNumber(file, pos, maxValue))
+    {
+        return fail("PPM", filename, "bad header");
+    }
+    if (maxValue != 255)
+    {
+        return fail("PPM", filename, "only 8 bit ppms (maximum value 255) are supported");
+    }
+    // exactly one whitespace byte separates the header from the data
+    layout.channels = 3;
+    layout.bgr = false;
+    layout.topDown = true;
+    layout.dataOffset = pos + 1;
+    layout.rowStride = 3 * (size_t)layout.width;
+    return checkExtent(file, "PPM", filename, layout);
+}
+
+void convertRowToRGB(const unsigned char* src, const PixelLayout& layout, float* dst)
+{
+    const float scale = 1.0f / 255.0f;
+    if (layout.channels == 4)
+    {
+        for (int x = 0; x < layout.width; x++)
+        {
+            dst[3 * x + 0] = src[4 * x + 0] * scale;
+            dst[3 * x + 1] = src[4 * x + 1] * scale;
+            dst[3 * x + 2] = src[4 * x + 2] * scale;
+        }
+    }
+    else
+    {
+        // 3 channels map byte for byte onto the floats, 16 at a time
+        const int n = 3 * layout.width;
+        int i = 0;
+#ifdef IMAGEFORMATS_USE_SSE
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 s = _mm_set1_ps(scale);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+            __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), s));
+            _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), s));
+            _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), s));
+            _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), s));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] = src[i] * scale;
+        }
+    }
+
+    if (layout.bgr)
+    {
+        for (int x = 0; x < layout.width; x++)
+        {
+            float b = dst[3 * x];
+            dst[3 * x] = dst[3 * x + 2];
+            dst[3 * x + 2] = b;
+        }
+    }
+}
+
+void convertRowToRGBA(const unsigned char* src, int count, const PixelLayout& layout, const float* table, float* dst)
+{
+    const int c = layout.channels;
+    const int r = layout.bgr ? 2 : 0;
+    const int b = layout.bgr ? 0 : 2;
+    for (int x = 0; x < count; x++)
+    {
+        dst[4 * x + 0] = table[src[c * x + r]];
+        dst[4 * x + 1] = table[src[c * x + 1]];
+        dst[4 * x + 2] = table[src[c * x + b]];
+        dst[4 * x + 3] = 0.0f;
+    }
+}
+
+// 4x4 Bayer matrix; the offsets it gives average out to plain rounding
+static const int bayer4[4][4] =
+{
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+Quantizer::Quantizer(const QuantizeSettings& settings)
+    : settings(settings)
+{
+    if (settings.gamma > 0.0f && settings.gamma != 1.0f)
+    {
+        gammaTable.resize(GammaTableSize);
+        for (int i = 0; i < GammaTableSize; i++)
+        {
+            gammaTable[i] = powf(i / (float)(GammaTableSize - 1), 1.0f / settings.gamma);
+        }
+    }
+}
+
+float Quantizer::encode(float v, float offset) const
+{
+    // written so NaN ends up as 0
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 1.0f ? v : 1.0f;
+    if (!gammaTable.empty())
+    {
+        v = gammaTable[(int)(v * (GammaTableSize - 1) + 0.5f)];
+    }
+    return v * 255.0f + offset;
+}
+
+void Quantizer::quantizeRow(const float* src, int width, int y, bool bgr, unsigned char* dst) const
+{
+    // what gets added before truncating: 0.5 rounds, the dither moves it
+    // around within the step
+    float offsets[4];
+    for (int i = 0; i < 4; i++)
+    {
+        offsets[i] = settings.dither ? (bayer4[y & 3][i] + 0.5f) / 16.0f : 0.5f;
+    }
+
+    int x = 0;
+#ifdef IMAGEFORMATS_USE_SSE
+    // 4 pixels are 12 floats, so 3 registers whose pixel boundaries fall in
+    // the same place every step; the dither period is 4 as well, so the
+    // offsets are the same for every step of the row
+    const __m128 o0 = _mm_setr_ps(offsets[0], offsets[0], offsets[0], offsets[1]);
+    const __m128 o1 = _mm_setr_ps(offsets[1], offsets[1], offsets[2], offsets[2]);
+    const __m128 o2 = _mm_setr_ps(offsets[2], offsets[3], offsets[3], offsets[3]);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 tableScale = _mm_set1_ps((float)(GammaTableSize - 1));
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128 v[3];
+        for (int i = 0; i < 3; i++)
+        {
+            // max first so NaN ends up as 0
+            v[i] = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 3 * x + 4 * i), zero), one);
+        }
+        if (!gammaTable.empty())
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                alignas(16) int index[4];
+                alignas(16) float encoded[4];
+                _mm_store_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v[i], tableScale), half)));
+                for (int j = 0; j < 4; j++)
+                {
+                    encoded[j] = gammaTable[index[j]];
+                }
+                v[i] = _mm_load_ps(encoded);
+            }
+        }
+        __m128i i0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v[0], scale), o0));
+        __m128i i1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v[1], scale), o1));
+        __m128i i2 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v[2], scale), o2));
+        // 32 -> 16 -> 8 bits, the first 12 bytes are the 4 pixels
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i2));
+        alignas(16) unsigned char bytes[16];
+        _mm_store_si128((__m128i*)bytes, packed);
+        memcpy(dst + 3 * x, bytes, 12);
+    }
+#endif
+    for (; x < width; x++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            dst[3 * x + c] = (unsigned char)encode(src[3 * x + c], offsets[x & 3]);
+        }
+    }
+
+    if (bgr)
+    {
+        for (x = 0; x < width; x++)
+        {
+            unsigned char r = dst[3 * x];
+            dst[3 * x] = dst[3 * x + 2];
+            dst[3 * x + 2] = r;
+        }
+    }
+}
+
+static void putLE(unsigned char* p, unsigned v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+std::vector<unsigned char> encodeTGAHeader(int width, int height)
+{
+    std::vector<unsigned char> header(18);
+    header[2] = 2;
+    putLE(&header[12], width, 2);
+    putLE(&header[14], height, 2);
+    header[16] = 24;
+    // top left origin
+    header[17] = 32;
+    return header;
+}
+
+std::vector<unsigned char> encodePPMHeader(int width, int height)
+{
+    char text[100];
+    int size = snprintf(text, sizeof(text), "P6\n# Creator: Image::SavePPM()\n%d %d\n255\n", width, height);
+    return std::vector<unsigned char>(text, text + size);
+}
+
+size_t bmpRowStride(int width)
+{
+    /* The length of each line must be a multiple of 4 bytes */
+    return ((size_t)3 * width + 3) & ~(size_t)3;
+}
+
+/****************************************************************************
+    bmp.c - read and write bmp images.
+    Distributed with Xplanet.
+    Copyright (C) 2002 Hari Nair <hari@alumni.caltech.edu>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+****************************************************************************/
+struct BMPHeader
+{
+    char bfType[3];       /* "BM" */
+    int bfSize;           /* Size of file in bytes */
+    int bfReserved;       /* set to 0 */
+    int bfOffBits;        /* Byte offset to actual bitmap data (= 54) */
+    int biSize;           /* Size of BITMAPINFOHEADER, in bytes (= 40) */
+    int biWidth;          /* Width of image, in pixels */
+    int biHeight;         /* Height of images, in pixels */
+    short biPlanes;       /* Number of planes in target device (set to 1) */
+    short biBitCount;     /* Bits per pixel (24 in this case) */
+    int biCompression;    /* Type of compression (0 if no compression) */
+    int biSizeImage;      /* Image size, in bytes (0 if no compression) */
+    int biXPelsPerMeter;  /* Resolution in pixels/meter of display device */
+    int biYPelsPerMeter;  /* Resolution in pixels/meter of display device */
+    int biClrUsed;        /* Number of colors in the color table (if 0, use
+                             maximum allowed by biBitCount) */
+    int biClrImportant;   /* Number of important colors.  If 0, all colors
+                             are important */
+};
+
+std::vector<unsigned char> encodeBMPHeader(int width, int height, bool topDown)
+{
+    struct BMPHeader bmph;
+    size_t bytesPerLine = bmpRowStride(width);
+
+    strcpy(bmph.bfType, "BM");
+    bmph.bfOffBits = 54;
+    bmph.bfSize = bmph.bfOffBits + (int)(bytesPerLine * height);
+    bmph.bfReserved = 0;
+    bmph.biSize = 40;
+    bmph.biWidth = width;
+    /* a negative height stores the top row first */
+    bmph.biHeight = topDown ? -height : height;
+    bmph.biPlanes = 1;
+    bmph.biBitCount = 24;
+    bmph.biCompression = 0;
+    bmph.biSizeImage = (int)(bytesPerLine * height);
+    bmph.biXPelsPerMeter = 0;
+    bmph.biYPelsPerMeter = 0;
+    bmph.biClrUsed = 0;
+    bmph.biClrImportant = 0;
+
+    std::vector<unsigned char> header(bmph.bfOffBits);
+    unsigned char* p = header.data();
+    memcpy(p, bmph.bfType, 2);
+    putLE(p + 2, bmph.bfSize, 4);
+    putLE(p + 6, bmph.bfReserved, 4);
+    putLE(p + 10, bmph.bfOffBits, 4);
+    putLE(p + 14, bmph.biSize, 4);
+    putLE(p + 18, bmph.biWidth, 4);
+    putLE(p + 22, bmph.biHeight, 4);
+    putLE(p + 26, bmph.biPlanes, 2);
+    putLE(p + 28, bmph.biBitCount, 2);
+    putLE(p + 30, bmph.biCompression, 4);
+    putLE(p + 34, bmph.biSizeImage, 4);
+    putLE(p + 38, bmph.biXPelsPerMeter, 4);
+    putLE(p + 42, bmph.biYPelsPerMeter, 4);
+    putLE(p + 46, bmph.biClrUsed, 4);
+    putLE(p + 50, bmph.biClrImportant, 4);
+    return header;
+}
+
+std::vector<unsigned char> encodePFMHeader(int width, int height)
+{
+    // a negative scale marks little endian floats
+    char text[100];
+    int size = snprintf(text, sizeof(text), "PF\n%d %d\n-1.0\n", width, height);
+    return std::vector<unsigned char>(text, text + size);
+}
+
+size_t exrScanlineSize(int width, bool halfFloat)
+{
+    // y and byte count, then one plane per channel
+    return 8 + (size_t)3 * width * (halfFloat ? 2 : 4);
+}
+
+static void putAttribute(std::vector<unsigned char>& out, const char* name, const char* type, const void* value, int size)
+{
+    out.insert(out.end(), name, name + strlen(name) + 1);
+    out.insert(out.end(), type, type + strlen(type) + 1);
+    unsigned char s[4];
+    putLE(s, size, 4);
+    out.insert(out.end(), s, s + 4);
+    out.insert(out.end(), (const unsigned char*)value, (const unsigned char*)value + size);
+}
+
+std::vector<unsigned char> encodeEXRHeader(int width, int height, bool halfFloat)
+{
+    // magic number and version 2, single part scanline file
+    std::vector<unsigned char> out = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+
+    // channels have to be listed in alphabetical order
+    std::vector<unsigned char> channels;
+    for (const char* name : { "B", "G", "R" })
+    {
+        unsigned char c[16] = { 0 };
+        putLE(c, halfFloat ? 1 : 2, 4);     // pixel type
+        putLE(c + 8, 1, 4);                 // x sampling
+        putLE(c + 12, 1, 4);                // y sampling
+        channels.push_back((unsigned char)name[0]);
+        channels.push_back(0);
+        channels.insert(channels.end(), c, c + 16);
+    }
+    channels.push_back(0);
+    putAttribute(out, "channels", "chlist", channels.data(), (int)channels.size());
+
+    unsigned char compression = 0;          // none
+    putAttribute(out, "compression", "compression", &compression, 1);
+    unsigned char window[16];
+    putLE(window, 0, 4);
+    putLE(window + 4, 0, 4);
+    putLE(window + 8, width - 1, 4);
+    putLE(window + 12, height - 1, 4);
+    putAttribute(out, "dataWindow", "box2i", window, 16);
+    putAttribute(out, "displayWindow", "box2i", window, 16);
+    unsigned char lineOrder = 0;            // increasing y, top row first
+    putAttribute(out, "lineOrder", "lineOrder", &lineOrder, 1);
+    const float one = 1.0f;
+    const float center[2] = { 0.0f, 0.0f };
+    putAttribute(out, "pixelAspectRatio", "float", &one, 4);
+    putAttribute(out, "screenWindowCenter", "v2f", center, 8);
+    putAttribute(out, "screenWindowWidth", "float", &one, 4);
+    out.push_back(0);
+
+    // without compression every scanline has the same size, so the offset
+    // table can be written before any of them
+    const size_t scanline = exrScanlineSize(width, halfFloat);
+    uint64_t offset = out.size() + (size_t)height * 8;
+    for (int y = 0; y < height; y++, offset += scanline)
+    {
+        unsigned char o[8];
+        putLE(o, (unsigned)offset, 4);
+        putLE(o + 4, (unsigned)(offset >> 32), 4);
+        out.insert(out.end(), o, o + 8);
+    }
+    return out;
+}
+
+void encodeEXRScanline(const float* rgb, int width, int y, bool halfFloat, unsigned char* out)
+{
+    const size_t bytes = exrScanlineSize(width, halfFloat);
+    putLE(out, y, 4);
+    putLE(out + 4, (unsigned)(bytes - 8), 4);
+    unsigned char* plane = out + 8;
+    // planes in channel order, b, g, r
+    for (int c = 2; c >= 0; c--)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            float v = rgb[3 * x + c];
+            if (halfFloat)
+            {
+                putLE(plane + 2 * x, floatToHalf(v), 2);
+            }
+            else
+            {
+                uint32_t bits;
+                memcpy(&bits, &v, 4);
+                putLE(plane + 4 * x, bits, 4);
+            }
+        }
+        plane += (size_t)width * (halfFloat ? 2 : 4);
+    }
+}
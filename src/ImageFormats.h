@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+// Where the pixels of an uncompressed 8 bit image file sit, as found by
+// validating its header once. Rows are rowStride bytes apart starting at
+// dataOffset; the header parsers also check that they all fit in the file.
+struct PixelLayout
+{
+    int width{ 0 };
+    int height{ 0 };
+    int channels{ 3 };      // bytes per pixel, 3 or 4 (the 4th is skipped)
+    bool bgr{ false };      // channels stored b, g, r
+    bool topDown{ false };  // first row in the file is the top of the image
+    size_t dataOffset{ 0 };
+    size_t rowStride{ 0 };
+
+    // row y counted from the top of the image
+    const unsigned char* row(const MappedFile& file, int y) const
+    {
+        int fileRow = topDown ? y : height - 1 - y;
+        return file.data() + dataOffset + (size_t)fileRow * rowStride;
+    }
+};
+
+// 24 or 32 bit uncompressed BMP, bottom up or top down
+bool parseBMPHeader(const MappedFile& file, const std::string& filename, PixelLayout& layout);
+// binary P6 PPM with a maximum value of 255, comments allowed
+bool parsePPMHeader(const MappedFile& file, const std::string& filename, PixelLayout& layout);
+// type 2 (uncompressed true colour) TGA, 24 or 32 bit, either origin
+bool parseTGAHeader(const MappedFile& file, const std::string& filename, PixelLayout& layout);
+
+// converts one row to r, g, b floats in [0, 1]
+void convertRowToRGB(const unsigned char* src, const PixelLayout& layout, float* dst);
+// converts one span of a row to r, g, b, pad floats through a 256 entry table
+void convertRowToRGBA(const unsigned char* src, int count, const PixelLayout& layout, const float* table, float* dst);
+
+// headers of the files the savers write; TGA and PPM rows go top first,
+// BMP rows top first only if topDown is set
+std::vector<unsigned char> encodeTGAHeader(int width, int height);
+std::vector<unsigned char> encodePPMHeader(int width, int height);
+std::vector<unsigned char> encodeBMPHeader(int width, int height, bool topDown);
+// BMP rows are padded to a multiple of 4 bytes
+size_t bmpRowStride(int width);
+
+// float formats: PFM rows are little endian r, g, b floats, bottom row first
+std::vector<unsigned char> encodePFMHeader(int width, int height);
+// uncompressed scanline OpenEXR with B, G, R channels, half or float. The
+// returned header includes the line offset table, so the scanlines can
+// follow straight away, top row (line 0) first.
+std::vector<unsigned char> encodeEXRHeader(int width, int height, bool halfFloat);
+size_t exrScanlineSize(int width, bool halfFloat);
+// writes EXR line y of r, g, b floats, exrScanlineSize() bytes
+void encodeEXRScanline(const float* rgb, int width, int y, bool halfFloat, unsigned char* out);
+
+// How floats in [0, 1] become 8 bit values when an image is written.
+struct QuantizeSettings
+{
+    float gamma{ 1.0f };    // values are raised to 1 / gamma first
+    bool dither{ false };   // 4x4 ordered dither, hides banding in gradients
+};
+
+// Converts rows of r, g, b floats to bytes, four pixels per step with SSE2.
+// Values are clamped to [0, 1] and rounded to nearest.
+class Quantizer
+{
+public:
+    explicit Quantizer(const QuantizeSettings& settings);
+
+    // y picks the dither row; bgr writes b, g, r as BMP and TGA want
+    void quantizeRow(const float* src, int width, int y, bool bgr, unsigned char* dst) const;
+
+private:
+    static const int GammaTableSize = 4096;
+
+    QuantizeSettings settings;
+    std::vector<float> gammaTable;      // empty for gamma 1
+
+    float encode(float v, float offset) const;
+};
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <iostream>
+
+#include "ImageStream.h"
+
+ImageStreamWriter::ImageStreamWriter(const std::string& filename, int width, int height,
+                                     const QuantizeSettings& settings, int maxQueuedBands)
+    : width(width), height(height), quantizer(settings), maxQueued(std::max(1, maxQueuedBands))
+{
+    std::vector<unsigned char> header;
+    const std::string ext = filename.size() > 4 ? filename.substr(filename.size() - 4, 4) : "";
+    if (ext == ".bmp")
+    {
+        header = encodeBMPHeader(width, height, true);
+        rowStride = bmpRowStride(width);
+    }
+    else if (ext == ".ppm")
+    {
+        header = encodePPMHeader(width, height);
+        rowStride = (size_t)width * 3;
+        bgr = false;
+    }
+    else if (ext == ".tga")
+    {
+        header = encodeTGAHeader(width, height);
+        rowStride = (size_t)width * 3;
+    }
+    else
+    {
+        std::cerr << "ImageStreamWriter ERROR: can't stream " << filename << ", use .tga, .bmp or .ppm" << std::endl;
+        return;
+    }
+
+    file = fopen(filename.c_str(), "wb");
+    if (file == nullptr || fwrite(header.data(), 1, header.size(), file) != header.size())
+    {
+        std::cerr << "ImageStreamWriter ERROR: can't write " << filename << std::endl;
+        if (file != nullptr)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+        return;
+    }
+    worker = std::thread(&ImageStreamWriter::run, this);
+}
+
+ImageStreamWriter::~ImageStreamWriter()
+{
+    close();
+}
+
+void ImageStreamWriter::writeBand(const Image& band)
+{
+    assert(band.Width() == width);
+    const int rows = std::min(band.Height(), height - rowsWritten);
+    if (file == nullptr || rows <= 0)
+    {
+        return;
+    }
+
+    std::vector<unsigned char> bytes;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [this]() { return queue.size() < maxQueued; });
+        if (!spare.empty())
+        {
+            bytes.swap(spare.back());
+            spare.pop_back();
+        }
+    }
+
+    // rows go out top first, (0,0) is the bottom left corner of the band;
+    // BMP padding bytes stay 0 from the first time a buffer is sized
+    bytes.resize(rowStride * rows);
+    scratch.resize((size_t)width * 3);
+    for (int i = 0; i < rows; i++)
+    {
+        const int y = band.Height() - 1 - i;
+        const int imageY = height - 1 - (rowsWritten + i);
+        quantizer.quantizeRow(band.Row(y, scratch.data()), width, imageY, bgr, &bytes[i * rowStride]);
+    }
+    rowsWritten += rows;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(bytes));
+    }
+    wake.notify_one();
+}
+
+bool ImageStreamWriter::close()
+{
+    if (file == nullptr)
+    {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    worker.join();
+
+    bool ok = !failed;
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    if (rowsWritten < height)
+    {
+        std::cerr << "ImageStreamWriter ERROR: only " << rowsWritten << " of " << height << " rows were written" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+void ImageStreamWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]() { return !queue.empty() || quit; });
+        if (queue.empty())
+        {
+            break;
+        }
+        std::vector<unsigned char> bytes = std::move(queue.front());
+        queue.pop_front();
+
+        lock.unlock();
+        if (!failed && fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size())
+        {
+            std::cerr << "ImageStreamWriter ERROR: write failed" << std::endl;
+            failed = true;
+        }
+        lock.lock();
+
+        spare.push_back(std::move(bytes));
+        space.notify_one();
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Image.h"
+#include "ImageFormats.h"
+
+// Writes an image to disk band by band from the top, so a frame never has
+// to exist in memory as a whole.
+//
+// Bands are quantized on the caller's thread and written by a background
+// thread. At most maxQueuedBands encoded bands wait for the disk at any
+// time; writeBand() blocks when that many are queued, which keeps memory
+// use constant however tall the image is. Works for the formats Image
+// writes: .tga, .bmp (stored top down) and .ppm.
+class ImageStreamWriter
+{
+    FILE* file{ nullptr };
+    int width;
+    int height;
+    int rowsWritten{ 0 };       // rows handed in so far, counted from the top
+    bool bgr{ true };
+    size_t rowStride{ 0 };
+    Quantizer quantizer;
+    std::vector<float> scratch;         // rows of half float bands
+    size_t maxQueued;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable space;
+    std::deque<std::vector<unsigned char>> queue;
+    std::vector<std::vector<unsigned char>> spare;  // written buffers for reuse
+    bool quit{ false };
+    bool failed{ false };
+
+    void run();
+public:
+    ImageStreamWriter() = delete;
+    ImageStreamWriter(const std::string& filename, int width, int height,
+                      const QuantizeSettings& settings = QuantizeSettings(), int maxQueuedBands = 2);
+    ~ImageStreamWriter();
+    ImageStreamWriter(const ImageStreamWriter&) = delete;
+    ImageStreamWriter& operator=(const ImageStreamWriter&) = delete;
+
+    bool valid() const { return file != nullptr; }
+
+    // band holds the band.Height() rows right below the ones written so far
+    // and must be as wide as the image
+    void writeBand(const Image& band);
+
+    // waits until everything is on disk and closes the file; false if a
+    // write failed or fewer rows than the image height came in
+    bool close();
+};
@@ -0,0 +1,233 @@
+#include <cstdint>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename, Access access)
+{
+    close();
+    DWORD flags = access == Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "MappedFile::open() ERROR: can't open " << filename << std::endl;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    bytes = (const unsigned char*)view;
+    length = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (bytes != nullptr)
+    {
+        UnmapViewOfFile(bytes);
+        CloseHandle((HANDLE)mappingHandle);
+        CloseHandle((HANDLE)fileHandle);
+    }
+    bytes = nullptr;
+    length = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename, Access access)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "MappedFile::open() ERROR: can't open " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    ::close(fd);
+    if (view == MAP_FAILED)
+    {
+        std::cerr << "MappedFile::open() ERROR: can't map " << filename << std::endl;
+        return false;
+    }
+    madvise(view, (size_t)st.st_size, access == Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    bytes = (const unsigned char*)view;
+    length = (size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (bytes != nullptr)
+    {
+        munmap((void*)bytes, length);
+    }
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif
+
+MappedRegion::~MappedRegion()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedRegion::create(const std::string& filename, size_t size)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "MappedRegion::create() ERROR: can't create " << filename << std::endl;
+        return false;
+    }
+    // sparse, so the untouched parts stay unallocated
+    DWORD returned;
+    DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        std::cerr << "MappedRegion::create() ERROR: can't map " << filename << std::endl;
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (view == NULL)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        std::cerr << "MappedRegion::create() ERROR: can't map " << filename << std::endl;
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    bytes = (unsigned char*)view;
+    length = size;
+    return true;
+}
+
+void MappedRegion::close()
+{
+    if (bytes != nullptr)
+    {
+        UnmapViewOfFile(bytes);
+        CloseHandle((HANDLE)mappingHandle);
+        CloseHandle((HANDLE)fileHandle);
+    }
+    bytes = nullptr;
+    length = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+void MappedRegion::flush()
+{
+    if (bytes != nullptr)
+    {
+        FlushViewOfFile(bytes, length);
+    }
+}
+
+#else
+
+bool MappedRegion::create(const std::string& filename, size_t size)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "MappedRegion::create() ERROR: can't create " << filename << std::endl;
+        return false;
+    }
+    // growing a truncated file leaves a hole, which reads back as zeros
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        ::close(fd);
+        std::cerr << "MappedRegion::create() ERROR: can't size " << filename << std::endl;
+        return false;
+    }
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED)
+    {
+        std::cerr << "MappedRegion::create() ERROR: can't map " << filename << std::endl;
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    // only honoured where the file system supports it, harmless elsewhere
+    madvise(view, size, MADV_HUGEPAGE);
+#endif
+    bytes = (unsigned char*)view;
+    length = size;
+    return true;
+}
+
+void MappedRegion::close()
+{
+    if (bytes != nullptr)
+    {
+        munmap(bytes, length);
+    }
+    bytes = nullptr;
+    length = 0;
+}
+
+void MappedRegion::flush()
+{
+    if (bytes != nullptr)
+    {
+        msync(bytes, length, MS_ASYNC);
+    }
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+//
+// The mapping lives as long as the object, so pointers into data() can be
+// kept around instead of copying the bytes out. An empty file or one that
+// can't be opened leaves the object invalid.
+class MappedFile
+{
+public:
+    enum Access
+    {
+        Sequential,     // read once front to back, e.g. an image load
+        Random          // looked up piecemeal, e.g. texture tiles
+    };
+
+    MappedFile() {}
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename, Access access = Sequential);
+    void close();
+
+    bool valid() const { return bytes != nullptr; }
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes{ nullptr };
+    size_t length{ 0 };
+#ifdef _WIN32
+    void* fileHandle{ nullptr };
+    void* mappingHandle{ nullptr };
+#endif
+};
+
+// Read-write shared mapping of a file created at a fixed size.
+//
+// Writes go straight to the page cache, so the data can be larger than RAM
+// and other processes can map the same file to watch it change. The file
+// starts out sparse: pages nobody touches take no memory or disk space.
+// Huge pages are requested where the kernel supports them for the file
+// (e.g. on tmpfs).
+class MappedRegion
+{
+public:
+    MappedRegion() {}
+    ~MappedRegion();
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+
+    // creates or truncates filename and maps size zeroed bytes of it
+    bool create(const std::string& filename, size_t size);
+    void close();
+    // starts writing dirty pages back to the file without waiting for it
+    void flush();
+
+    bool valid() const { return bytes != nullptr; }
+    unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    unsigned char* bytes{ nullptr };
+    size_t length{ 0 };
+#ifdef _WIN32
+    void* fileHandle{ nullptr };
+    void* mappingHandle{ nullptr };
+#endif
+};
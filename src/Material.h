@@ -1,11 +1,13 @@
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <glm/glm.hpp>
 
 #include "Ray.h"
 #include "Hit.h"
 #include "Texture.h"
+#include "TextureCache.h"
 
 
 class Material
@@ -15,7 +17,28 @@ public:
 
 	void loadTexture(const char* filename)
 	{
-		t.load(filename);
+		// materials naming the same file share one texture
+		t = TextureCache::instance().getTexture(filename);
+	}
+
+	// index in the scene's material list, used for material id output
+	int getId() const { return id; }
+	void setId(int _id) { id = _id; }
+
+	glm::vec3 getDiffuseColor() const { return diffuseColor; }
+	glm::vec3 getSpecularColor() const { return specularColor; }
+	float getShininess() const { return shininess; }
+	const std::shared_ptr<Texture>& getTexture() const { return t; }
+	void setTexture(const std::shared_ptr<Texture>& texture) { t = texture; }
+
+	glm::vec3 getAlbedo(const Hit& hit)
+	{
+		if (t && t->valid() && hit.isTexDefined())
+		{
+			glm::vec2 uv = hit.getTexCoord();
+			return t->sample(uv.x, uv.y, hit.getTexFootprint());
+		}
+		return diffuseColor;
 	}
 
 	glm::vec3 shade(const Ray& ray, const Hit& hit, const glm::vec3& directionToLight, const glm::vec3& lightColor)
@@ -27,6 +50,7 @@ protected:
 	glm::vec3 diffuseColor;
 	glm::vec3 specularColor;
 	float shininess;
-	Texture t;
+	std::shared_ptr<Texture> t;
+	int id{ -1 };
 };
 
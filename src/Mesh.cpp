@@ -1,110 +1,73 @@
 #include "Mesh.h"
-#include <fstream>
-#include <iostream>
 #include <algorithm>
 #include <cstdlib>
 #include <utility>
-#include <sstream>
 
-bool Mesh::intersect(const Ray& r, Hit& h, float tmin) {
-    bool result = false;
-    for (unsigned int i = 0; i < t.size(); i++) {
-        Triangle triangle(v[t[i][0]],
-            v[t[i][1]], v[t[i][2]], material);
-        for (int jj = 0; jj < 3; jj++) {
-            triangle.normals[jj] = n[t[i][jj]];
-
-        }
-        if (texCoord.size() > 0) {
+namespace {
+    bool intersectTriangles(const MeshData& data, Material* material, int first, int count, const Ray& r, Hit& h, float tmin) {
+        bool result = false;
+        for (int i = first; i < first + count; i++) {
+            const Trig& trig = data.t[i];
+            Triangle triangle(data.v[trig[0]],
+                data.v[trig[1]], data.v[trig[2]], material);
             for (int jj = 0; jj < 3; jj++) {
-                triangle.texCoords[jj] = texCoord[t[i].texID[jj]];
-            }
-            triangle.hasTex = true;
-        }
-        result |= triangle.intersect(r, h, tmin);
-    }
-    return result;
-}
+                triangle.normals[jj] = data.n[trig[jj]];
 
-Mesh::Mesh(const char* filename, Material* material) :Object3D(material)
-{
-    std::ifstream f;
-    f.open(filename);
-    if (!f.is_open()) {
-        std::cout << "Cannot open " << filename << "\n";
-        return;
-    }
-    std::string line;
-    std::string vTok("v");
-    std::string fTok("f");
-    std::string texTok("vt");
-    char bslash = '/', space = ' ';
-    std::string tok;
-    while (1) {
-        std::getline(f, line);
-        if (f.eof()) {
-            break;
-        }
-        if (line.size() < 3) {
-            continue;
-        }
-        if (line.at(0) == '#') {
-            continue;
-        }
-        std::stringstream ss(line);
-        ss >> tok;
-        if (tok == vTok) {
-            glm::vec3 vec;
-            ss >> vec[0] >> vec[1] >> vec[2];
-            v.push_back(vec);
-        }
-        else if (tok == fTok) {
-            if (line.find(bslash) != std::string::npos) {
-                std::replace(line.begin(), line.end(), bslash, space);
-                std::stringstream facess(line);
-                Trig trig;
-                facess >> tok;
-                for (int ii = 0; ii < 3; ii++) {
-                    facess >> trig[ii] >> trig.texID[ii];
-                    trig[ii]--;
-                    trig.texID[ii]--;
-                }
-                t.push_back(trig);
             }
-            else {
-                Trig trig;
-                for (int ii = 0; ii < 3; ii++) {
-                    ss >> trig[ii];
-                    trig[ii]--;
-                    trig.texID[ii] = 0;
+            if (data.texCoordCount > 0) {
+                for (int jj = 0; jj < 3; jj++) {
+                    triangle.texCoords[jj] = data.texCoord[trig.texID[jj]];
                 }
-                t.push_back(trig);
+                triangle.hasTex = true;
             }
+            result |= triangle.intersect(r, h, tmin);
         }
-        else if (tok == texTok) {
-            glm::vec2 texcoord;
-            ss >> texcoord[0];
-            ss >> texcoord[1];
-            texCoord.push_back(texcoord);
-        }
+        return result;
     }
-    compute_norm();
+}
 
-    f.close();
+bool intersectMesh(const MeshData& data, Material* material, const Ray& r, Hit& h, float tmin) {
+    return intersectBVH(data.nodes, data.nodeCount, r, h, tmin, [&](int first, int count) {
+        return intersectTriangles(data, material, first, count, r, h, tmin);
+    });
 }
 
-void Mesh::compute_norm()
-{
-    n.resize(v.size());
-    for (unsigned int ii = 0; ii < t.size(); ii++) {
-        glm::vec3 a = v[t[ii][1]] - v[t[ii][0]];
-        glm::vec3 b = v[t[ii][2]] - v[t[ii][0]];
-        b = glm::cross(a, b);
-        for (int jj = 0; jj < 3; jj++) {
-            n[t[ii][jj]] += b;
-        }
+void intersectMeshBatch(const MeshData& data, Material* material, const Ray* rays, Hit* hits, bool* results, int count, float tmin) {
+    intersectBVHBatch(data.nodes, data.nodeCount, data.treelets, data.treeletCount, rays, hits, count, tmin,
+        [&](int ray, int first, int n) {
+            bool hit = intersectTriangles(data, material, first, n, rays[ray], hits[ray], tmin);
+            if (hit) {
+                results[ray] = true;
+            }
+            return hit;
+        });
+}
+
+bool Mesh::intersect(const Ray& r, Hit& h, float tmin) {
+    return intersectMesh(*data, material, r, h, tmin);
+}
+
+void Mesh::intersectBatch(const Ray* rays, Hit* hits, bool* results, int count, float tmin) {
+    intersectMeshBatch(*data, material, rays, hits, results, count, tmin);
+}
+
+bool LazyMesh::intersect(const Ray& r, Hit& h, float tmin) {
+    float tNear;
+    if (!intersectBounds(geometry->bounds, r.getOrigin(), glm::vec3(1.0f) / r.getDirection(), tmin, h.getT(), tNear)) {
+        return false;
     }
-    for (unsigned int ii = 0; ii < v.size(); ii++) {
-        n[ii] = glm::normalize(n[ii]);
+    GeometryStreamer& streamer = GeometryStreamer::instance();
+    streamer.touch(*geometry);
+    const MeshData* data = geometry->resident.load(std::memory_order_acquire);
+    if (data == nullptr) {
+        streamer.request(*geometry);
+        GeometryStreamer::markStalled();
+        return false;
     }
+    return intersectMesh(*data, material, r, h, tmin);
+}
+
+Mesh::Mesh(const char* filename, Material* material) :Object3D(material),
+    data(GeometryCache::instance().getMesh(filename))
+{
 }
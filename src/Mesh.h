@@ -2,27 +2,38 @@
 
 #include <glm/glm.hpp>
 
+#include <memory>
 #include <vector>
 #include "Object3D.h"
+#include "GeometryCache.h"
+#include "GeometryStreamer.h"
 #include "Triangle.h"
 
-// by default counterclockwise winding is front face
-struct Trig {
-	Trig() { x[0] = 0; x[1] = 0; x[2] = 0; }
-	int& operator[](const int i) { return x[i]; }
-	int x[3];
-	int texID[3];
-};
-
 class Mesh : public Object3D {
 public:
+	// shares the file's data through GeometryCache, loading it on first use
 	Mesh(const char* filename, Material* m);
-	std::vector<glm::vec3>v;
-	std::vector<Trig>t;
-	std::vector<glm::vec3>n;
-	std::vector<glm::vec2>texCoord;
+	// empty mesh, for a scene snapshot or an asynchronous load to fill in
+	Mesh(Material* m) : Object3D(m), data(std::make_shared<MeshData>()) {}
+	// shared with every other mesh made from the same file
+	std::shared_ptr<const MeshData> data;
 
 	virtual bool intersect(const Ray& r, Hit& h, float tmin);
-private:
-	void compute_norm();
-};
\ No newline at end of file
+	// traverses the BVH treelet by treelet for the whole batch
+	virtual void intersectBatch(const Ray* rays, Hit* hits, bool* results, int count, float tmin);
+};
+
+// intersects the triangles of data through its BVH
+bool intersectMesh(const MeshData& data, Material* material, const Ray& r, Hit& h, float tmin);
+void intersectMeshBatch(const MeshData& data, Material* material, const Ray* rays, Hit* hits, bool* results, int count, float tmin);
+
+// A mesh that only knows its bounds until a ray enters them, then loads
+// through GeometryStreamer. Rays that get there before the data are marked
+// stalled and miss.
+class LazyMesh : public Object3D {
+public:
+	LazyMesh(StreamedGeometry* geometry, Material* m) : Object3D(m), geometry(geometry) {}
+	StreamedGeometry* geometry;
+
+	virtual bool intersect(const Ray& r, Hit& h, float tmin);
+};
@@ -0,0 +1,658 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+
+#include "MeshCache.h"
+
+namespace
+{
+    const uint32_t CacheVersion = 4;
+    const size_t SectionAlignment = 64;
+    const size_t NodeAlignment = 4096;
+
+    // start of a cache file; every section starts on a 64 byte boundary
+    struct MeshCacheHeader
+    {
+        char magic[8];          // "SRTMESH"
+        uint32_t version;
+        uint32_t trigSize;      // layout checks, so a cache from a different
+        uint32_t nodeSize;      // build is rebuilt instead of misread
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+        uint64_t vertexCount;
+        uint64_t texCoordCount;
+        uint64_t triangleCount;
+        uint64_t nodeCount;
+        uint64_t treeletCount;
+        uint64_t vOffset;
+        uint64_t nOffset;
+        uint64_t texCoordOffset;
+        uint64_t tOffset;
+        uint64_t nodeOffset;
+        uint64_t treeletOffset;
+    };
+
+    struct SourceInfo
+    {
+        uint64_t size;
+        int64_t time;
+    };
+
+    bool sourceInfo(const std::string& filename, SourceInfo& info)
+    {
+        std::error_code ec;
+        info.size = std::filesystem::file_size(filename, ec);
+        if (ec)
+        {
+            return false;
+        }
+        info.time = (int64_t)std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    // fast 64 bit hash, only meant to notice a changed file
+    uint64_t hashBytes(const unsigned char* p, size_t n)
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            h = (h ^ w) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        for (; i < n; i++)
+        {
+            h = (h ^ p[i]) * 0xc4ceb9fe1a85ec53ull;
+        }
+        return h ^ (h >> 29);
+    }
+
+    bool hashFile(const std::string& filename, uint64_t& hash)
+    {
+        MappedFile file;
+        if (!file.open(filename, MappedFile::Sequential))
+        {
+            return false;
+        }
+        hash = hashBytes(file.data(), file.size());
+        return true;
+    }
+
+    size_t alignSection(size_t n, size_t alignment = SectionAlignment)
+    {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+    bool sectionFits(uint64_t offset, uint64_t count, size_t elementSize, size_t fileSize)
+    {
+        return offset % SectionAlignment == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+    }
+
+    // a vertex as shading sees it; two corners can only share one index if
+    // both of these match bit for bit
+    struct ShadedVertex
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    // Renumbers the values that trigs index through field so values that
+    // are identical bit for bit share one index and values no triangle uses are dropped. With
+    // firstUse the indices follow the order the triangles first use them,
+    // so the values of a BVH leaf sit next to each other; otherwise the
+    // values keep their order. Returns how many duplicates were merged.
+    template <typename T>
+    size_t compactVertices(std::vector<T>& values, std::vector<Trig>& trigs, int (Trig::*field)[3], bool firstUse)
+    {
+        const size_t count = values.size();
+        std::vector<uint32_t> sorted(count);
+        std::iota(sorted.begin(), sorted.end(), 0u);
+        std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b)
+        {
+            int order = memcmp(&values[a], &values[b], sizeof(T));
+            return order != 0 ? order < 0 : a < b;
+        });
+
+        // every value maps to the first of its duplicates
+        std::vector<uint32_t> canonical(count);
+        size_t merged = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            canonical[sorted[i]] = sorted[i];
+            if (i > 0 && memcmp(&values[sorted[i]], &values[sorted[i - 1]], sizeof(T)) == 0)
+            {
+                canonical[sorted[i]] = canonical[sorted[i - 1]];
+                merged++;
+            }
+        }
+        std::vector<uint32_t>().swap(sorted);
+
+        const uint32_t Unused = 0xffffffffu;
+        std::vector<uint32_t> remap(count, Unused);
+        std::vector<T> compacted;
+        compacted.reserve(count - merged);
+        if (!firstUse)
+        {
+            for (const Trig& trig : trigs)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    remap[canonical[(trig.*field)[k]]] = 0;
+                }
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                if (remap[i] != Unused)
+                {
+                    remap[i] = (uint32_t)compacted.size();
+                    compacted.push_back(values[i]);
+                }
+            }
+        }
+        for (Trig& trig : trigs)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                int& index = (trig.*field)[k];
+                uint32_t c = canonical[index];
+                if (remap[c] == Unused)
+                {
+                    remap[c] = (uint32_t)compacted.size();
+                    compacted.push_back(values[c]);
+                }
+                index = (int)remap[c];
+            }
+        }
+        values.swap(compacted);
+        return merged;
+    }
+
+    // Model of a 32KB, 8-way set associative L1 with 64 byte lines and LRU
+    // replacement, for comparing vertex layouts.
+    class CacheModel
+    {
+        static const int Ways = 8;
+        static const int Sets = 64;
+        uint64_t tags[Sets][Ways];
+        uint64_t used[Sets][Ways];
+        uint64_t clock{ 0 };
+    public:
+        size_t misses{ 0 };
+
+        CacheModel()
+        {
+            memset(tags, 0xff, sizeof(tags));
+            memset(used, 0, sizeof(used));
+        }
+
+        void read(uint64_t address)
+        {
+            const uint64_t line = address / 64;
+            uint64_t* setTags = tags[line % Sets];
+            uint64_t* setUsed = used[line % Sets];
+            clock++;
+            int oldest = 0;
+            for (int w = 0; w < Ways; w++)
+            {
+                if (setTags[w] == line)
+                {
+                    setUsed[w] = clock;
+                    return;
+                }
+                if (setUsed[w] < setUsed[oldest])
+                {
+                    oldest = w;
+                }
+            }
+            misses++;
+            setTags[oldest] = line;
+            setUsed[oldest] = clock;
+        }
+    };
+
+    // misses of the vertex position reads of every triangle, in leaf order
+    size_t vertexCacheMisses(const std::vector<Trig>& trigs)
+    {
+        CacheModel cache;
+        for (const Trig& trig : trigs)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                // a position can straddle two lines
+                uint64_t address = (uint64_t)trig[k] * sizeof(glm::vec3);
+                cache.read(address);
+                cache.read(address + sizeof(glm::vec3) - 1);
+            }
+        }
+        return cache.misses;
+    }
+}
+
+void MeshData::build(ObjData& obj, MeshLayoutStats* stats)
+{
+    ownedV.swap(obj.v);
+    ownedTexCoord.swap(obj.texCoord);
+
+    std::vector<uint32_t> order;
+    buildBVH(ownedV.data(), obj.t.data(), obj.t.size(), ownedNodes, order);
+    layoutTreelets(ownedNodes, order, ownedTreelets);
+    ownedT.resize(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        ownedT[i] = obj.t[order[i]];
+    }
+    std::vector<Trig>().swap(obj.t);
+
+    // area weighted face normals, summed at the vertices
+    ownedN.assign(ownedV.size(), glm::vec3(0.0f));
+    for (const Trig& trig : ownedT)
+    {
+        glm::vec3 a = ownedV[trig[1]] - ownedV[trig[0]];
+        glm::vec3 b = ownedV[trig[2]] - ownedV[trig[0]];
+        b = glm::cross(a, b);
+        for (int jj = 0; jj < 3; jj++)
+        {
+            ownedN[trig[jj]] += b;
+        }
+    }
+    for (glm::vec3& normal : ownedN)
+    {
+        // vertices no face uses keep a zero normal instead of a NaN
+        float length = glm::length(normal);
+        if (length > 0.0f)
+        {
+            normal /= length;
+        }
+    }
+
+    // OBJ files list their vertices in whatever order the exporter had
+    // them; follow the triangles instead. Normals are computed first and
+    // merged vertices must share theirs, so a vertex split for a hard edge
+    // stays split and the image doesn't change.
+    MeshLayoutStats layout;
+    layout.missesBefore = vertexCacheMisses(ownedT);
+    std::vector<ShadedVertex> shaded(ownedV.size());
+    for (size_t i = 0; i < shaded.size(); i++)
+    {
+        shaded[i].position = ownedV[i];
+        shaded[i].normal = ownedN[i];
+    }
+    layout.mergedVertices = compactVertices(shaded, ownedT, &Trig::x, false);
+    layout.unusedVertices = ownedV.size() - layout.mergedVertices - shaded.size();
+    layout.missesAfter = vertexCacheMisses(ownedT);
+    // a file whose order already follows the surface (a scanned grid, say)
+    // can cache slightly better as it is, so first use order has to earn it
+    std::vector<ShadedVertex> reordered(shaded);
+    std::vector<Trig> renumbered(ownedT);
+    compactVertices(reordered, renumbered, &Trig::x, true);
+    const size_t misses = vertexCacheMisses(renumbered);
+    const bool firstUse = misses < layout.missesAfter;
+    if (firstUse)
+    {
+        shaded.swap(reordered);
+        ownedT.swap(renumbered);
+        layout.missesAfter = misses;
+    }
+    std::vector<ShadedVertex>().swap(reordered);
+    std::vector<Trig>().swap(renumbered);
+    ownedV.resize(shaded.size());
+    ownedN.resize(shaded.size());
+    for (size_t i = 0; i < shaded.size(); i++)
+    {
+        ownedV[i] = shaded[i].position;
+        ownedN[i] = shaded[i].normal;
+    }
+    std::vector<ShadedVertex>().swap(shaded);
+    if (!ownedTexCoord.empty())
+    {
+        compactVertices(ownedTexCoord, ownedT, &Trig::texID, firstUse);
+    }
+    if (stats != nullptr)
+    {
+        *stats = layout;
+    }
+
+    file.reset();
+    v = ownedV.data();
+    n = ownedN.data();
+    vertexCount = ownedV.size();
+    texCoord = ownedTexCoord.data();
+    texCoordCount = ownedTexCoord.size();
+    t = ownedT.data();
+    triangleCount = ownedT.size();
+    nodes = ownedNodes.data();
+    nodeCount = ownedNodes.size();
+    treelets = ownedTreelets.data();
+    treeletCount = ownedTreelets.empty() ? 0 : ownedTreelets.size() - 1;
+}
+
+bool MeshData::attach(const std::shared_ptr<MappedFile>& file, size_t offset, size_t size)
+{
+    if (offset > file->size() || size > file->size() - offset || size < sizeof(MeshCacheHeader))
+    {
+        return false;
+    }
+    const unsigned char* base = file->data() + offset;
+    MeshCacheHeader header;
+    memcpy(&header, base, sizeof(header));
+    bool valid = memcmp(header.magic, "SRTMESH", 8) == 0
+        && header.version == CacheVersion
+        && header.trigSize == sizeof(Trig)
+        && header.nodeSize == sizeof(BVHNode)
+        && sectionFits(header.vOffset, header.vertexCount, sizeof(glm::vec3), size)
+        && sectionFits(header.nOffset, header.vertexCount, sizeof(glm::vec3), size)
+        && sectionFits(header.texCoordOffset, header.texCoordCount, sizeof(glm::vec2), size)
+        && sectionFits(header.tOffset, header.triangleCount, sizeof(Trig), size)
+        && sectionFits(header.nodeOffset, header.nodeCount, sizeof(BVHNode), size)
+        && sectionFits(header.treeletOffset, header.treeletCount + 1, sizeof(uint32_t), size);
+    if (!valid)
+    {
+        return false;
+    }
+
+    std::vector<glm::vec3>().swap(ownedV);
+    std::vector<glm::vec3>().swap(ownedN);
+    std::vector<glm::vec2>().swap(ownedTexCoord);
+    std::vector<Trig>().swap(ownedT);
+    std::vector<BVHNode>().swap(ownedNodes);
+    std::vector<uint32_t>().swap(ownedTreelets);
+    this->file = file;
+    v = (const glm::vec3*)(base + header.vOffset);
+    n = (const glm::vec3*)(base + header.nOffset);
+    vertexCount = (size_t)header.vertexCount;
+    texCoord = (const glm::vec2*)(base + header.texCoordOffset);
+    texCoordCount = (size_t)header.texCoordCount;
+    t = (const Trig*)(base + header.tOffset);
+    triangleCount = (size_t)header.triangleCount;
+    nodes = (const BVHNode*)(base + header.nodeOffset);
+    nodeCount = (size_t)header.nodeCount;
+    treelets = (const uint32_t*)(base + header.treeletOffset);
+    treeletCount = (size_t)header.treeletCount;
+    return true;
+}
+
+bool MeshData::verify() const
+{
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            if (t[i].x[k] < 0 || (uint64_t)t[i].x[k] >= vertexCount)
+            {
+                return false;
+            }
+            if (texCoordCount > 0 && (t[i].texID[k] < 0 || (uint64_t)t[i].texID[k] >= texCoordCount))
+            {
+                return false;
+            }
+        }
+    }
+
+    // the stacks hold 64 entries; a node at depth d needs d + 1
+    const int MaxDepth = 62;
+    std::vector<unsigned char> depth(nodeCount, 0);
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        const BVHNode& node = nodes[i];
+        if (node.count < 0 || node.leftFirst < 0)
+        {
+            return false;
+        }
+        if (node.isLeaf())
+        {
+            if ((uint64_t)node.leftFirst + (uint64_t)node.count > triangleCount)
+            {
+                return false;
+            }
+            continue;
+        }
+        // children come after their parent, so this pass sees every
+        // parent before its children and the tree can't loop
+        if ((uint64_t)node.leftFirst <= i || (uint64_t)node.leftFirst + 1 >= nodeCount || depth[i] >= MaxDepth)
+        {
+            return false;
+        }
+        depth[node.leftFirst] = std::max(depth[node.leftFirst], (unsigned char)(depth[i] + 1));
+        depth[node.leftFirst + 1] = std::max(depth[node.leftFirst + 1], (unsigned char)(depth[i] + 1));
+    }
+
+    if (treeletCount > 0)
+    {
+        if (treelets[0] != 0 || treelets[treeletCount] != nodeCount)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < treeletCount; i++)
+        {
+            if (treelets[i] >= treelets[i + 1])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void encodeMeshImage(const MeshData& data, std::vector<unsigned char>& out)
+{
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SRTMESH", 8);
+    header.version = CacheVersion;
+    header.trigSize = sizeof(Trig);
+    header.nodeSize = sizeof(BVHNode);
+    header.vertexCount = data.vertexCount;
+    header.texCoordCount = data.texCoordCount;
+    header.triangleCount = data.triangleCount;
+    header.nodeCount = data.nodeCount;
+    header.treeletCount = data.treeletCount;
+
+    size_t size = alignSection(sizeof(header));
+    header.vOffset = size;
+    size += alignSection(data.vertexCount * sizeof(glm::vec3));
+    header.nOffset = size;
+    size += alignSection(data.vertexCount * sizeof(glm::vec3));
+    header.texCoordOffset = size;
+    size += alignSection(data.texCoordCount * sizeof(glm::vec2));
+    header.tOffset = size;
+    size += alignSection(data.triangleCount * sizeof(Trig));
+    size = alignSection(size, NodeAlignment);
+    header.nodeOffset = size;
+    size += alignSection(data.nodeCount * sizeof(BVHNode));
+    header.treeletOffset = size;
+    size += alignSection((data.treeletCount + 1) * sizeof(uint32_t));
+
+    out.assign(size, 0);
+    memcpy(out.data(), &header, sizeof(header));
+    auto copySection = [&](uint64_t offset, const void* src, size_t bytes)
+    {
+        if (bytes > 0)
+        {
+            memcpy(out.data() + offset, src, bytes);
+        }
+    };
+    copySection(header.vOffset, data.v, data.vertexCount * sizeof(glm::vec3));
+    copySection(header.nOffset, data.n, data.vertexCount * sizeof(glm::vec3));
+    copySection(header.texCoordOffset, data.texCoord, data.texCoordCount * sizeof(glm::vec2));
+    copySection(header.tOffset, data.t, data.triangleCount * sizeof(Trig));
+    copySection(header.nodeOffset, data.nodes, data.nodeCount * sizeof(BVHNode));
+    if (data.treeletCount > 0)
+    {
+        copySection(header.treeletOffset, data.treelets, (data.treeletCount + 1) * sizeof(uint32_t));
+    }
+}
+
+std::string meshCachePath(const std::string& objFilename)
+{
+    return objFilename + ".meshcache";
+}
+
+namespace
+{
+    // maps the cache of objFilename if it was built from the OBJ as it is now
+    bool openMeshCache(const std::string& objFilename, std::shared_ptr<MappedFile>& file)
+    {
+        std::string path = meshCachePath(objFilename);
+        SourceInfo source;
+        std::error_code ec;
+        if (!sourceInfo(objFilename, source) || !std::filesystem::exists(path, ec))
+        {
+            return false;
+        }
+        file = std::make_shared<MappedFile>();
+        if (!file->open(path, MappedFile::Random) || file->size() < sizeof(MeshCacheHeader))
+        {
+            return false;
+        }
+
+        MeshCacheHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        if (header.sourceSize != source.size)
+        {
+            return false;
+        }
+        if (header.sourceTime != source.time)
+        {
+            uint64_t hash;
+            if (!hashFile(objFilename, hash) || hash != header.sourceHash)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+bool loadMeshCache(const std::string& objFilename, MeshData& data)
+{
+    std::shared_ptr<MappedFile> file;
+    if (!openMeshCache(objFilename, file))
+    {
+        return false;
+    }
+    if (!data.attach(file, 0, file->size()))
+    {
+        std::cout << meshCachePath(objFilename) << " is not a mesh cache of this build, rebuilding it" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool loadMeshCacheBounds(const std::string& objFilename, glm::vec3& boundsMin, glm::vec3& boundsMax, size_t& bytes)
+{
+    std::shared_ptr<MappedFile> file;
+    if (!openMeshCache(objFilename, file))
+    {
+        return false;
+    }
+    // only the header and the root node get paged in
+    MeshCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    bool valid = memcmp(header.magic, "SRTMESH", 8) == 0
+        && header.version == CacheVersion
+        && header.nodeSize == sizeof(BVHNode)
+        && header.nodeCount > 0
+        && sectionFits(header.nodeOffset, header.nodeCount, sizeof(BVHNode), file->size());
+    if (!valid)
+    {
+        return false;
+    }
+    BVHNode root;
+    memcpy(&root, file->data() + header.nodeOffset, sizeof(root));
+    boundsMin = root.boundsMin;
+    boundsMax = root.boundsMax;
+    bytes = file->size();
+    return true;
+}
+
+bool writeMeshCache(const std::string& objFilename, const MeshData& data)
+{
+    if (!data.verify())
+    {
+        std::cerr << "writeMeshCache() ERROR: " << objFilename << " has out of range indices, not caching it" << std::endl;
+        return false;
+    }
+    SourceInfo source;
+    uint64_t hash;
+    if (!sourceInfo(objFilename, source) || !hashFile(objFilename, hash))
+    {
+        return false;
+    }
+    std::vector<unsigned char> buffer;
+    encodeMeshImage(data, buffer);
+    MeshCacheHeader* header = (MeshCacheHeader*)buffer.data();
+    header->sourceSize = source.size;
+    header->sourceTime = source.time;
+    header->sourceHash = hash;
+
+    std::string path = meshCachePath(objFilename);
+    std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "writeMeshCache() ERROR: can't create " << temporary << std::endl;
+        return false;
+    }
+    bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    ok = fclose(file) == 0 && ok;
+    // rename() won't replace an existing file everywhere
+    if (ok && std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(path.c_str());
+        ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        std::cerr << "writeMeshCache() ERROR: can't write " << path << std::endl;
+        std::remove(temporary.c_str());
+    }
+    return ok;
+}
+
+bool convertMesh(const std::string& objFilename)
+{
+    ObjData obj;
+    ObjLoadStats stats;
+    if (!loadObj(objFilename, obj, 0, &stats))
+    {
+        return false;
+    }
+    MeshData data;
+    MeshLayoutStats layout;
+    data.build(obj, &layout);
+    if (!writeMeshCache(objFilename, data))
+    {
+        return false;
+    }
+    std::cout << meshCachePath(objFilename) << ": " << data.vertexCount << " vertices, "
+              << data.triangleCount << " triangles, " << data.nodeCount << " BVH nodes, "
+              << layout << std::endl;
+    return true;
+}
+
+bool verifyMeshCache(const std::string& objFilename)
+{
+    MeshData data;
+    if (!loadMeshCache(objFilename, data))
+    {
+        std::cout << meshCachePath(objFilename) << ": missing or out of date" << std::endl;
+        return false;
+    }
+    bool ok = data.verify();
+    std::cout << meshCachePath(objFilename) << (ok ? ": ok" : ": damaged, delete it to rebuild") << std::endl;
+    return ok;
+}
+
+std::ostream& operator<<(std::ostream& out, const MeshLayoutStats& stats)
+{
+    out << stats.mergedVertices << " duplicate and " << stats.unusedVertices << " unused vertices removed, "
+        << "vertex cache misses " << stats.missesBefore << " -> " << stats.missesAfter;
+    return out;
+}
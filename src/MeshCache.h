@@ -0,0 +1,123 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "MappedFile.h"
+#include "ObjLoader.h"
+
+// What build() did to the vertex layout of a mesh. The misses are counted
+// by a model of a 32KB 8-way L1 cache fed the vertex positions of every
+// triangle in BVH leaf order, with the vertices as the OBJ listed them and
+// as build() left them.
+struct MeshLayoutStats
+{
+    size_t mergedVertices{ 0 };     // same position and normal, folded into one
+    size_t unusedVertices{ 0 };     // no triangle referenced them
+    size_t missesBefore{ 0 };
+    size_t missesAfter{ 0 };
+};
+
+std::ostream& operator<<(std::ostream& out, const MeshLayoutStats& stats);
+
+// Everything a Mesh needs at render time: vertices with their normals,
+// texture coordinates, triangles in BVH leaf order and the BVH itself.
+//
+// The arrays either belong to the object (after build()) or point straight
+// into a mapped mesh image (after loadMeshCache() or attach()); either way
+// they are read through the pointers below.
+class MeshData
+{
+public:
+    const glm::vec3* v{ nullptr };
+    const glm::vec3* n{ nullptr };
+    size_t vertexCount{ 0 };
+    const glm::vec2* texCoord{ nullptr };
+    size_t texCoordCount{ 0 };
+    const Trig* t{ nullptr };
+    size_t triangleCount{ 0 };
+    const BVHNode* nodes{ nullptr };
+    size_t nodeCount{ 0 };
+    // first node of every treelet (see layoutTreelets()), then nodeCount
+    const uint32_t* treelets{ nullptr };
+    size_t treeletCount{ 0 };
+
+    MeshData() {}
+    MeshData(const MeshData&) = delete;
+    MeshData& operator=(const MeshData&) = delete;
+
+    // takes over the arrays of a loaded OBJ, builds the BVH, laid out in
+    // treelets, puts the triangles in its leaf order and computes vertex
+    // normals; then merges vertices whose position and normal both match
+    // and renumbers them (and the texture coordinates) in the order the
+    // triangles first use them
+    void build(ObjData& obj, MeshLayoutStats* stats = nullptr);
+
+    // points the arrays at a mesh image (see encodeMeshImage()) of size
+    // bytes at offset in file, which stays mapped as long as the mesh
+    // does; false if the header is damaged, from a different build or
+    // claims sections outside the image. The sections themselves are not
+    // read, see verify().
+    bool attach(const std::shared_ptr<MappedFile>& file, size_t offset, size_t size);
+
+    // checks what the header can't: that every triangle indexes existing
+    // vertices and texture coordinates, that every node points at existing
+    // children or triangles, deeper than itself and no deeper than a
+    // traversal stack holds, and that the treelet table covers the nodes in
+    // order. Reads every array, so it runs when a mesh image is written and
+    // for -verify-mesh rather than on every load.
+    bool verify() const;
+
+    bool IsMapped() const
+    {
+        return file != nullptr;
+    }
+
+private:
+    std::vector<glm::vec3> ownedV;
+    std::vector<glm::vec3> ownedN;
+    std::vector<glm::vec2> ownedTexCoord;
+    std::vector<Trig> ownedT;
+    std::vector<BVHNode> ownedNodes;
+    std::vector<uint32_t> ownedTreelets;
+    std::shared_ptr<MappedFile> file;
+};
+
+// Serializes data the way a mesh cache stores it: a header followed by the
+// arrays, each 64 byte aligned (the nodes 4KB aligned, so every treelet
+// covers as few pages as it can), all addressed by offsets from the start of
+// the image so it can be embedded anywhere (e.g. in a scene snapshot).
+void encodeMeshImage(const MeshData& data, std::vector<unsigned char>& out);
+
+// the cache file for an OBJ sits next to it
+std::string meshCachePath(const std::string& objFilename);
+
+// Maps the cache of objFilename into data without copying anything.
+//
+// The cache records the size, modification time and a hash of the OBJ it
+// was built from. It is used when size and time still match; if only the
+// time changed (a copy, a touch) the OBJ is hashed and the cache is used
+// if the contents are the same. Returns false if there is no usable cache.
+bool loadMeshCache(const std::string& objFilename, MeshData& data);
+
+// reads just the bounds of the mesh from an up to date cache, and how big
+// the cache is, without touching the rest of it
+bool loadMeshCacheBounds(const std::string& objFilename, glm::vec3& boundsMin, glm::vec3& boundsMax, size_t& bytes);
+
+// writes data as the cache of objFilename, through a temporary file so a
+// concurrent reader never sees half of it
+bool writeMeshCache(const std::string& objFilename, const MeshData& data);
+
+// loads objFilename and (re)writes its cache; for converting meshes ahead
+// of a render
+bool convertMesh(const std::string& objFilename);
+
+// runs MeshData::verify() over the cache of objFilename, for caches that
+// may have been damaged on disk since they were written
+bool verifyMeshCache(const std::string& objFilename);
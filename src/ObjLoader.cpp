@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+namespace
+{
+    // big enough that thread overhead vanishes, small enough that a few
+    // hundred MB still spreads over every core
+    const size_t ChunkSize = 4u << 20;
+
+    // what one chunk of lines parsed into, with indices resolved against
+    // the chunk's own counts until the merge knows where it starts
+    struct Chunk
+    {
+        const char* begin{ nullptr };
+        const char* end{ nullptr };
+        std::vector<glm::vec3> v;
+        std::vector<glm::vec2> texCoord;
+        std::vector<Trig> t;
+        // corners (3 * triangle + corner) that used negative indices and
+        // so need the offset of the chunk's first vertex / texcoord added
+        std::vector<uint32_t> relativeV;
+        std::vector<uint32_t> relativeT;
+        int lines{ 0 };
+        int errorLine{ 0 };     // 1-based within the chunk, 0 if fine
+        const char* error{ nullptr };
+    };
+
+    bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    void skipSpace(const char*& p, const char* end)
+    {
+        while (p < end && isSpace(*p))
+        {
+            p++;
+        }
+    }
+
+    bool isDigit(char c)
+    {
+        return (unsigned)(c - '0') < 10u;
+    }
+
+    // strtod on a copy, for the rare number the fast path can't do exactly
+    // (huge exponents, inf, nan); the mapping has no terminating zero
+    bool parseFloatSlow(const char*& p, const char* end, float& out)
+    {
+        char buffer[64];
+        size_t n = 0;
+        while (p + n < end && n < sizeof(buffer) - 1 && !isSpace(p[n]) && p[n] != '\n')
+        {
+            buffer[n] = p[n];
+            n++;
+        }
+        buffer[n] = '\0';
+        char* stop = nullptr;
+        double value = strtod(buffer, &stop);
+        if (stop == buffer)
+        {
+            return false;
+        }
+        p += stop - buffer;
+        out = (float)value;
+        return true;
+    }
+
+    bool parseFloat(const char*& p, const char* end, float& out)
+    {
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        const char* s = p;
+        bool negative = false;
+        if (s < end && (*s == '-' || *s == '+'))
+        {
+            negative = *s == '-';
+            s++;
+        }
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        bool digits = false;
+        for (; s < end && isDigit(*s); s++)
+        {
+            digits = true;
+            if (mantissa < 100000000000000000ull)
+            {
+                mantissa = mantissa * 10 + (*s - '0');
+            }
+            else
+            {
+                exponent++;
+            }
+        }
+        if (s < end && *s == '.')
+        {
+            s++;
+            for (; s < end && isDigit(*s); s++)
+            {
+                digits = true;
+                if (mantissa < 100000000000000000ull)
+                {
+                    mantissa = mantissa * 10 + (*s - '0');
+                    exponent--;
+                }
+            }
+        }
+        if (!digits)
+        {
+            return parseFloatSlow(p, end, out);
+        }
+        if (s < end && (*s == 'e' || *s == 'E'))
+        {
+            const char* e = s + 1;
+            bool negativeExponent = false;
+            if (e < end && (*e == '-' || *e == '+'))
+            {
+                negativeExponent = *e == '-';
+                e++;
+            }
+            if (e < end && isDigit(*e))
+            {
+                int value = 0;
+                for (; e < end && isDigit(*e); e++)
+                {
+                    value = std::min(value * 10 + (*e - '0'), 10000);
+                }
+                exponent += negativeExponent ? -value : value;
+                s = e;
+            }
+        }
+        // exact when the mantissa fits a double, which covers every
+        // coordinate an exporter writes
+        if (mantissa >= (1ull << 53) || exponent < -22 || exponent > 22)
+        {
+            return parseFloatSlow(p, end, out);
+        }
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+        out = (float)(negative ? -value : value);
+        p = s;
+        return true;
+    }
+
+    bool parseInt(const char*& p, const char* end, int& out)
+    {
+        const char* s = p;
+        bool negative = false;
+        if (s < end && (*s == '-' || *s == '+'))
+        {
+            negative = *s == '-';
+            s++;
+        }
+        if (s == end || !isDigit(*s))
+        {
+            return false;
+        }
+        long long value = 0;
+        for (; s < end && isDigit(*s); s++)
+        {
+            value = value * 10 + (*s - '0');
+            if (value > 0x7fffffff)
+            {
+                return false;
+            }
+        }
+        out = (int)(negative ? -value : value);
+        p = s;
+        return true;
+    }
+
+    // a value has to be followed by whitespace or the end of the line
+    bool atSeparator(const char* p, const char* end)
+    {
+        return p == end || isSpace(*p);
+    }
+
+    // 1-based or negative OBJ index to 0-based, relative to count for
+    // negative ones; false for 0
+    bool resolveIndex(int index, int count, int& out, bool& relative)
+    {
+        if (index > 0)
+        {
+            out = index - 1;
+            relative = false;
+            return true;
+        }
+        if (index < 0)
+        {
+            out = count + index;
+            relative = true;
+            return true;
+        }
+        return false;
+    }
+
+    struct Corner
+    {
+        int v;
+        int vt;
+        bool relativeV;
+        bool relativeT;
+    };
+
+    const char* parseFace(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& corners)
+    {
+        corners.clear();
+        while (true)
+        {
+            skipSpace(p, end);
+            if (p == end)
+            {
+                break;
+            }
+            Corner corner{ 0, 0, false, false };
+            int index;
+            if (!parseInt(p, end, index) || !resolveIndex(index, (int)chunk.v.size(), corner.v, corner.relativeV))
+            {
+                return "bad vertex index";
+            }
+            if (p < end && *p == '/')
+            {
+                p++;
+                if (p < end && *p != '/')
+                {
+                    if (!parseInt(p, end, index) ||
+                        !resolveIndex(index, (int)chunk.texCoord.size(), corner.vt, corner.relativeT))
+                    {
+                        return "bad texture coordinate index";
+                    }
+                }
+                if (p < end && *p == '/')
+                {
+                    // normals are recomputed, the index only has to be there
+                    p++;
+                    if (!parseInt(p, end, index))
+                    {
+                        return "bad normal index";
+                    }
+                }
+            }
+            if (!atSeparator(p, end))
+            {
+                return "bad face corner";
+            }
+            corners.push_back(corner);
+        }
+        if (corners.size() < 3)
+        {
+            return "face with fewer than 3 corners";
+        }
+
+        // fan around the first corner
+        for (size_t k = 1; k + 1 < corners.size(); k++)
+        {
+            const Corner* fan[3] = { &corners[0], &corners[k], &corners[k + 1] };
+            Trig trig;
+            for (int jj = 0; jj < 3; jj++)
+            {
+                uint32_t slot = (uint32_t)(chunk.t.size() * 3 + jj);
+                trig[jj] = fan[jj]->v;
+                trig.texID[jj] = fan[jj]->vt;
+                if (fan[jj]->relativeV)
+                {
+                    chunk.relativeV.push_back(slot);
+                }
+                if (fan[jj]->relativeT)
+                {
+                    chunk.relativeT.push_back(slot);
+                }
+            }
+            chunk.t.push_back(trig);
+        }
+        return nullptr;
+    }
+
+    const char* parseLine(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& corners)
+    {
+        skipSpace(p, end);
+        if (p == end || *p == '#')
+        {
+            return nullptr;
+        }
+        const char* keyword = p;
+        while (p < end && !isSpace(*p))
+        {
+            p++;
+        }
+        size_t length = p - keyword;
+
+        if (length == 1 && keyword[0] == 'v')
+        {
+            glm::vec3 vec;
+            for (int i = 0; i < 3; i++)
+            {
+                skipSpace(p, end);
+                if (!parseFloat(p, end, vec[i]) || !atSeparator(p, end))
+                {
+                    return "bad vertex";
+                }
+            }
+            chunk.v.push_back(vec);
+        }
+        else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't')
+        {
+            glm::vec2 texcoord(0.0f);
+            for (int i = 0; i < 2; i++)
+            {
+                skipSpace(p, end);
+                // v is optional
+                if (i == 1 && p == end)
+                {
+                    break;
+                }
+                if (!parseFloat(p, end, texcoord[i]) || !atSeparator(p, end))
+                {
+                    return "bad texture coordinate";
+                }
+            }
+            chunk.texCoord.push_back(texcoord);
+        }
+        else if (length == 1 && keyword[0] == 'f')
+        {
+            return parseFace(p, end, chunk, corners);
+        }
+        return nullptr;
+    }
+
+    void parseChunk(Chunk& chunk)
+    {
+        std::vector<Corner> corners;
+        const char* p = chunk.begin;
+        while (p < chunk.end)
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+            if (lineEnd == nullptr)
+            {
+                lineEnd = chunk.end;
+            }
+            chunk.lines++;
+            const char* error = parseLine(p, lineEnd, chunk, corners);
+            if (error != nullptr)
+            {
+                chunk.error = error;
+                chunk.errorLine = chunk.lines;
+                return;
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    bool inRange(const Trig& trig, const int (Trig::*indices)[3], int count)
+    {
+        for (int jj = 0; jj < 3; jj++)
+        {
+            if ((trig.*indices)[jj] < 0 || (trig.*indices)[jj] >= count)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+bool loadObj(const std::string& filename, ObjData& data, int threads, ObjLoadStats* stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(filename, MappedFile::Sequential))
+    {
+        std::cerr << "loadObj() ERROR: can't read " << filename << std::endl;
+        return false;
+    }
+
+    // cut on line boundaries so no line straddles two chunks
+    std::vector<Chunk> chunks;
+    const char* text = (const char*)file.data();
+    const char* textEnd = text + file.size();
+    for (const char* p = text; p < textEnd;)
+    {
+        const char* end = p + std::min(ChunkSize, (size_t)(textEnd - p));
+        if (end < textEnd)
+        {
+            const char* newline = (const char*)memchr(end, '\n', textEnd - end);
+            end = newline != nullptr ? newline + 1 : textEnd;
+        }
+        chunks.emplace_back();
+        chunks.back().begin = p;
+        chunks.back().end = end;
+        p = end;
+    }
+
+    parallelFor((int)chunks.size(), threads, [&](int i)
+    {
+        parseChunk(chunks[i]);
+    });
+
+    // prefix sums give each chunk its offsets into the merged arrays
+    std::vector<size_t> vOffset(chunks.size() + 1, 0);
+    std::vector<size_t> texOffset(chunks.size() + 1, 0);
+    std::vector<size_t> tOffset(chunks.size() + 1, 0);
+    std::vector<int> firstLine(chunks.size() + 1, 1);
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const Chunk& chunk = chunks[i];
+        if (chunk.error != nullptr)
+        {
+            std::cerr << filename << ":" << firstLine[i] + chunk.errorLine - 1 << ": " << chunk.error << std::endl;
+            return false;
+        }
+        firstLine[i + 1] = firstLine[i] + chunk.lines;
+        vOffset[i + 1] = vOffset[i] + chunk.v.size();
+        texOffset[i + 1] = texOffset[i] + chunk.texCoord.size();
+        tOffset[i + 1] = tOffset[i] + chunk.t.size();
+    }
+
+    data.v.resize(vOffset.back());
+    data.texCoord.resize(texOffset.back());
+    data.t.resize(tOffset.back());
+    const int vertexCount = (int)data.v.size();
+    const int texCount = (int)data.texCoord.size();
+    std::vector<char> badChunk(chunks.size(), 0);
+    parallelFor((int)chunks.size(), threads, [&](int i)
+    {
+        Chunk& chunk = chunks[i];
+        std::copy(chunk.v.begin(), chunk.v.end(), data.v.begin() + vOffset[i]);
+        std::copy(chunk.texCoord.begin(), chunk.texCoord.end(), data.texCoord.begin() + texOffset[i]);
+        Trig* t = data.t.data() + tOffset[i];
+        std::copy(chunk.t.begin(), chunk.t.end(), t);
+        for (uint32_t slot : chunk.relativeV)
+        {
+            t[slot / 3].x[slot % 3] += (int)vOffset[i];
+        }
+        for (uint32_t slot : chunk.relativeT)
+        {
+            t[slot / 3].texID[slot % 3] += (int)texOffset[i];
+        }
+        for (size_t k = 0; k < chunk.t.size(); k++)
+        {
+            // faces without texture coordinates keep texID 0
+            if (!inRange(t[k], &Trig::x, vertexCount) || (texCount > 0 && !inRange(t[k], &Trig::texID, texCount)))
+            {
+                badChunk[i] = 1;
+                break;
+            }
+        }
+        // the chunk's own copies are no longer needed
+        std::vector<glm::vec3>().swap(chunk.v);
+        std::vector<glm::vec2>().swap(chunk.texCoord);
+        std::vector<Trig>().swap(chunk.t);
+    });
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (badChunk[i])
+        {
+            // triangles don't remember their line, but the chunk does
+            std::cerr << filename << ":" << firstLine[i] << "-" << firstLine[i + 1] - 1
+                      << ": face index out of range" << std::endl;
+            return false;
+        }
+    }
+
+    if (stats != nullptr)
+    {
+        stats->bytes = file.size();
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats->chunks = (int)chunks.size();
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// by default counterclockwise winding is front face
+struct Trig {
+	Trig() { x[0] = 0; x[1] = 0; x[2] = 0; texID[0] = 0; texID[1] = 0; texID[2] = 0; }
+	int& operator[](const int i) { return x[i]; }
+	const int& operator[](const int i) const { return x[i]; }
+	int x[3];
+	int texID[3];
+};
+
+// what an OBJ file contributes to a Mesh; indices are 0-based
+struct ObjData
+{
+    std::vector<glm::vec3> v;
+    std::vector<glm::vec2> texCoord;
+    std::vector<Trig> t;
+};
+
+struct ObjLoadStats
+{
+    size_t bytes{ 0 };
+    double seconds{ 0.0 };
+    int chunks{ 0 };
+
+    double megabytesPerSecond() const
+    {
+        return seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+    }
+};
+
+// Loads the geometry of a Wavefront OBJ file.
+//
+// The file is memory mapped and cut into chunks of a few MB on line
+// boundaries, which are parsed on separate threads with a hand-written
+// number parser. Each chunk collects its own vertices, texture coordinates
+// and triangles; prefix sums over the chunk sizes then give every chunk its
+// place in the output, so the merge is one allocation per array and a
+// parallel copy.
+//
+// Faces may have any number of corners (fanned into triangles) in any of
+// the v, v/vt, v/vt/vn and v//vn forms, with 1-based or negative (relative)
+// indices. Normals, groups and materials are ignored. Returns false with a
+// message naming the line on a malformed file or an out of range index.
+bool loadObj(const std::string& filename, ObjData& data, int threads = 0, ObjLoadStats* stats = nullptr);
@@ -17,4 +17,17 @@ public:
 	Object3D(Material* material) { this->material = material; }
 
 	virtual bool intersect(const Ray& ray, Hit& hit, float tmin) = 0;
+
+	// intersects count rays at once, setting results[i] for the rays that
+	// hit; objects that can share work between rays override it
+	virtual void intersectBatch(const Ray* rays, Hit* hits, bool* results, int count, float tmin)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (intersect(rays[i], hits[i], tmin))
+			{
+				results[i] = true;
+			}
+		}
+	}
 };
\ No newline at end of file
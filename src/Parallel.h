@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// number of worker threads to use when the caller asks for "as many as possible"
+inline int defaultThreadCount()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : (int)n;
+}
+
+// Runs fn(i) for every i in [0, count) on up to numThreads threads.
+// Work items are handed out through a shared counter, so items should be
+// coarse (a tile, a block of rows) rather than single pixels.
+template <typename Fn>
+void parallelFor(int count, int numThreads, const Fn& fn)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = defaultThreadCount();
+    }
+    numThreads = std::min(numThreads, count);
+
+    if (numThreads <= 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next{ 0 };
+    auto worker = [&]()
+    {
+        for (int i = next++; i < count; i = next++)
+        {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (int t = 1; t < numThreads; t++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// Like parallelFor(), but on the threads of pool plus the caller, so the
+// workers and their thread_local state outlive the call. A null pool runs
+// everything on the caller.
+template <typename Fn>
+void parallelFor(ThreadPool* pool, int count, const Fn& fn)
+{
+    std::atomic<int> next{ 0 };
+    auto worker = [&]()
+    {
+        for (int i = next++; i < count; i = next++)
+        {
+            fn(i);
+        }
+    };
+
+    std::vector<std::future<void>> helpers;
+    if (pool != nullptr)
+    {
+        for (int t = 0; t < std::min(pool->getThreadCount(), count - 1); t++)
+        {
+            helpers.push_back(pool->submit(worker));
+        }
+    }
+    worker();
+    for (auto& helper : helpers)
+    {
+        helper.get();
+    }
+}
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "Renderer.h"
+#include "AllocationCounter.h"
+#include "GeometryStreamer.h"
+#include "Parallel.h"
+
+namespace
+{
+    // samples traced per intersectBatch() call
+    const int BatchSize = 1024;
+
+    // tiles per thread in one round while geometry streams
+    const int StreamingTilesPerThread = 4;
+
+    struct TileSample
+    {
+        int x, y;
+        uint32_t sample;
+    };
+
+    // per-thread buffers for one batch; the render threads belong to the
+    // Renderer, so these are allocated on each thread's first tile and
+    // reused for every tile of every pass after it
+    struct TileScratch
+    {
+        std::vector<TileSample> samples;
+        std::vector<Ray> rays;
+        std::vector<Hit> hits;
+        std::unique_ptr<bool[]> results;
+
+        TileScratch() : hits(BatchSize), results(new bool[BatchSize])
+        {
+            samples.reserve(BatchSize);
+            rays.reserve(BatchSize);
+        }
+
+        static TileScratch& get()
+        {
+            thread_local TileScratch scratch;
+            return scratch;
+        }
+    };
+}
+
+Renderer::Renderer(SceneParser& scene, const RenderSettings& settings) : scene(scene), settings(settings), sampler(settings.sampler, settings.seed)
+{
+    this->settings.baseSamples = std::max(1, settings.baseSamples);
+    this->settings.maxSamples = std::max(this->settings.baseSamples, settings.maxSamples);
+    this->settings.tileSize = std::max(1, settings.tileSize);
+    // the calling thread renders too
+    int threads = settings.threads > 0 ? settings.threads : defaultThreadCount();
+    if (threads > 1)
+    {
+        pool.reset(new ThreadPool(threads - 1));
+    }
+}
+
+void Renderer::setSeed(uint32_t seed)
+{
+    settings.seed = seed;
+    sampler = Sampler(settings.sampler, seed);
+}
+
+RenderStats Renderer::render(Framebuffer& fb, int firstPass)
+{
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(settings.timeBudget);
+    rowOffset = 0;
+    imageHeight = fb.Height();
+    return renderPasses(fb, firstPass, true);
+}
+
+RenderStats Renderer::renderBands(int width, int height, int bandHeight, const BandCallback& callback)
+{
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(settings.timeBudget);
+    imageHeight = height;
+    bandHeight = std::max(1, bandHeight);
+
+    RenderStats total;
+    total.converged = true;
+    for (int top = height; top > 0; top -= bandHeight)
+    {
+        rowOffset = std::max(0, top - bandHeight);
+        // once out of time or cancelled, the remaining bands get only their
+        // first pass, which always completes
+        Framebuffer band(width, top - rowOffset);
+        RenderStats stats = renderPasses(band, 0, false);
+        total.passes = std::max(total.passes, stats.passes);
+        total.samples += stats.samples;
+        total.converged = total.converged && stats.converged;
+        total.timedOut = total.timedOut || stats.timedOut;
+        total.cancelled = total.cancelled || stats.cancelled;
+        callback(band, rowOffset);
+    }
+    return total;
+}
+
+RenderStats Renderer::renderPasses(Framebuffer& fb, int firstPass, bool reportPasses)
+{
+    const int ts = settings.tileSize;
+    tiles.clear();
+    for (int y = 0; y < fb.Height(); y += ts)
+    {
+        for (int x = 0; x < fb.Width(); x += ts)
+        {
+            tiles.push_back({ x, y, std::min(x + ts, fb.Width()), std::min(y + ts, fb.Height()) });
+        }
+    }
+    tileActive.assign(tiles.size(), 1);
+
+    RenderStats stats;
+    if (firstPass > 0)
+    {
+        // the tile flags are a pure function of the pixel statistics, so
+        // they can be rebuilt instead of stored
+        for (size_t t = 0; t < tiles.size(); t++)
+        {
+            bool active = false;
+            for (int y = tiles[t].y0; y < tiles[t].y1 && !active; y++)
+            {
+                for (int x = tiles[t].x0; x < tiles[t].x1 && !active; x++)
+                {
+                    active = needsSamples(fb, x, y);
+                }
+            }
+            tileActive[t] = active;
+        }
+        for (size_t i = 0; i < (size_t)fb.Width() * fb.Height(); i++)
+        {
+            stats.samples += fb.Data()[i].count;
+        }
+        stats.passes = firstPass;
+    }
+
+    for (int pass = firstPass; ; pass++)
+    {
+        stats.samples += renderPass(fb, passTarget(pass), pass > 0, pass > 0);
+        if (pass > 0 && shouldStop())
+        {
+            stats.cancelled = cancelled;
+            stats.timedOut = !cancelled;
+            break;
+        }
+        stats.passes++;
+        if (passCallback && reportPasses)
+        {
+            passCallback(fb, stats);
+        }
+        if (std::count(tileActive.begin(), tileActive.end(), 1) == 0)
+        {
+            stats.converged = true;
+            break;
+        }
+    }
+    return stats;
+}
+
+int Renderer::passTarget(int pass) const
+{
+    long long target;
+    if (settings.progressive)
+    {
+        target = (long long)settings.baseSamples << std::min(pass, 30);
+    }
+    else
+    {
+        target = (long long)settings.baseSamples * (pass + 1);
+    }
+    return (int)std::min<long long>(target, settings.maxSamples);
+}
+
+bool Renderer::shouldStop() const
+{
+    if (cancelled)
+    {
+        return true;
+    }
+    return settings.timeBudget > 0 && std::chrono::steady_clock::now() >= deadline;
+}
+
+bool Renderer::needsSamples(const Framebuffer& fb, int x, int y) const
+{
+    if (fb.GetStats(x, y).count >= (unsigned int)settings.maxSamples)
+    {
+        return false;
+    }
+    return fb.GetError(x, y) > settings.errorThreshold;
+}
+
+unsigned long long Renderer::renderPass(Framebuffer& fb, int targetSamples, bool adaptive, bool interruptible)
+{
+    std::atomic<unsigned long long> samples{ 0 };
+    Camera* camera = scene.getCamera();
+    GeometryStreamer& streamer = GeometryStreamer::instance();
+    const unsigned long long allocations = AllocationCounter::getCount();
+
+    // tiles whose rays stalled on streamed geometry are run again once it has
+    // loaded
+    std::vector<int> work(tiles.size());
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        work[t] = (int)t;
+    }
+    std::vector<char> deferred(tiles.size(), 0);
+    // geometry a round touches stays resident until the next round, so with
+    // streaming on the tiles go in small rounds and the streamer can evict
+    // between them
+    const int threads = pool ? pool->getThreadCount() + 1 : 1;
+    const bool streaming = streamer.isEnabled();
+    auto renderTile = [&](int tileIndex)
+    {
+        if (!tileActive[tileIndex] || (interruptible && shouldStop()))
+        {
+            return;
+        }
+        const Tile& tile = tiles[tileIndex];
+        TileScratch& scratch = TileScratch::get();
+        BVHBatchScratch::get().reserve(BatchSize);
+        // from here on the tile stays off the heap
+        AllocationCounter::Forbid forbid;
+
+        // the tile's samples are traced in batches, so a mesh pages each
+        // treelet in once per batch instead of once per ray
+        int tileSamples = 0;
+        bool stalled = false;
+        auto traceBatch = [&]()
+        {
+            const int n = (int)scratch.rays.size();
+            std::fill_n(scratch.hits.begin(), n, Hit());
+            std::fill_n(scratch.results.get(), n, false);
+            scene.getGroup()->intersectBatch(scratch.rays.data(), scratch.hits.data(), scratch.results.get(), n, camera->getTMin());
+            scratch.rays.clear();
+            if (GeometryStreamer::takeStalled())
+            {
+                // the batch is dropped and the tile run again once the
+                // geometry it needs has loaded, topping its pixels up
+                // from where they got to
+                stalled = true;
+                scratch.samples.clear();
+                return;
+            }
+            for (int i = 0; i < n; i++)
+            {
+                const TileSample& s = scratch.samples[i];
+                AovSample aov;
+                glm::vec3 color = shade(scratch.hits[i], scratch.results[i], s.x, s.y + rowOffset, s.sample, aov);
+                fb.AddSample(s.x, s.y, color, aov);
+            }
+            tileSamples += n;
+            scratch.samples.clear();
+        };
+        for (int y = tile.y0; y < tile.y1 && !stalled; y++)
+        {
+            for (int x = tile.x0; x < tile.x1 && !stalled; x++)
+            {
+                // the sample index is the pixel's own sample count, so every
+                // value drawn depends only on (pixel, sample, dimension)
+                const int imageY = y + rowOffset;
+                uint32_t first = fb.GetStats(x, y).count;
+                int n = targetSamples - (int)first;
+                if (n <= 0 || (adaptive && !needsSamples(fb, x, y)))
+                {
+                    continue;
+                }
+                for (int s = 0; s < n && !stalled; s++)
+                {
+                    uint32_t sample = first + s;
+                    glm::vec2 subpixel = sampler.get2D(x, imageY, sample, DimPixel);
+                    scratch.rays.push_back(camera->generatePixelRay(x, imageY, fb.Width(), imageHeight, subpixel));
+                    scratch.samples.push_back({ x, y, sample });
+                    if ((int)scratch.rays.size() == BatchSize)
+                    {
+                        traceBatch();
+                    }
+                }
+            }
+        }
+        if (!stalled && !scratch.rays.empty())
+        {
+            traceBatch();
+        }
+        samples += tileSamples;
+        if (stalled)
+        {
+            deferred[tileIndex] = 1;
+            return;
+        }
+
+        bool active = false;
+        for (int y = tile.y0; y < tile.y1 && !active; y++)
+        {
+            for (int x = tile.x0; x < tile.x1 && !active; x++)
+            {
+                active = needsSamples(fb, x, y);
+            }
+        }
+        tileActive[tileIndex] = active;
+    };
+
+    while (!work.empty())
+    {
+        const int roundTiles = streaming ? threads * StreamingTilesPerThread : (int)work.size();
+        for (size_t start = 0; start < work.size(); start += roundTiles)
+        {
+            const int count = (int)std::min((size_t)roundTiles, work.size() - start);
+            parallelFor(pool.get(), count, [&](int i)
+            {
+                renderTile(work[start + i]);
+            });
+            // between rounds no ray is in flight, which is when the streamer
+            // may evict
+            streamer.sync();
+        }
+        work.clear();
+        for (size_t t = 0; t < tiles.size(); t++)
+        {
+            if (deferred[t])
+            {
+                work.push_back((int)t);
+                deferred[t] = 0;
+            }
+        }
+    }
+
+    if (AllocationCounter::getCount() != allocations)
+    {
+        std::cerr << "error: the render loop allocated " << AllocationCounter::getCount() - allocations
+                  << " times in one pass" << std::endl;
+        std::abort();
+    }
+    return samples;
+}
+
+// x, y and sample identify the sampler stream for light and bounce
+// dimensions once shading needs them
+glm::vec3 Renderer::shade(const Hit& hit, bool intersected, int x, int y, uint32_t sample, AovSample& aov) const
+{
+    if (intersected)
+    {
+        // AOVs come from the primary hit, no extra traversal needed
+        aov.hit = true;
+        aov.depth = hit.getT();
+        aov.normal = glm::normalize(hit.getNormal());
+        if (hit.getMaterial() != nullptr)
+        {
+            aov.albedo = hit.getMaterial()->getAlbedo(hit);
+            aov.materialId = hit.getMaterial()->getId();
+        }
+        return settings.foreground;
+    }
+    return settings.background;
+}
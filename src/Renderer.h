@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "SceneParser.h"
+#include "Framebuffer.h"
+#include "Sampler.h"
+#include "ThreadPool.h"
+
+struct RenderSettings
+{
+    int threads{ 0 };               // 0 picks the hardware concurrency
+    int tileSize{ 16 };
+    int baseSamples{ 1 };           // every pixel gets at least this many
+    int maxSamples{ 1 };            // per pixel cap, adaptive when > baseSamples
+    float errorThreshold{ 0.01f };  // relative error a pixel has to reach to stop
+    bool progressive{ false };      // double the samples per pixel every pass
+    long long timeBudget{ 0 };      // milliseconds, 0 means no limit
+    SamplerType sampler{ SamplerType::Sobol };
+    uint32_t seed{ 0 };
+    glm::vec3 foreground{ 0.8f, 0.2f, 0.0f };
+    glm::vec3 background{ 0.0f, 0.2f, 0.4f };
+};
+
+struct RenderStats
+{
+    int passes{ 0 };                // completed passes
+    unsigned long long samples{ 0 };
+    bool converged{ false };        // every pixel met the threshold or the cap
+    bool timedOut{ false };
+    bool cancelled{ false };
+};
+
+// Renders the scene tile by tile into a Framebuffer, in passes.
+//
+// Pass p brings every pixel up to a target sample count: baseSamples for the
+// first pass, then baseSamples more per pass, or twice as many in
+// progressive mode, never more than maxSamples. From the second pass on only
+// pixels whose error estimate is still above errorThreshold are sampled,
+// tiles without such pixels are skipped, and rendering stops as soon as no
+// tile is left, the time budget runs out or cancel() is called.
+//
+// The first pass always completes so the framebuffer is never partially
+// filled. Because a pass only tops pixels up to its target, a pass that was
+// interrupted halfway can simply be run again. The same goes for tiles whose
+// rays stalled on streamed geometry (see GeometryStreamer): they are run
+// again within the pass once it has loaded.
+class Renderer
+{
+public:
+    typedef std::function<void(const Framebuffer&, const RenderStats&)> PassCallback;
+    // a finished band and the image row its bottom row sits at
+    typedef std::function<void(const Framebuffer&, int)> BandCallback;
+
+private:
+    struct Tile
+    {
+        int x0, y0, x1, y1;
+    };
+
+    SceneParser& scene;
+    RenderSettings settings;
+    Sampler sampler;
+    std::vector<Tile> tiles;
+    std::vector<char> tileActive;
+    PassCallback passCallback;
+    std::atomic<bool> cancelled{ false };
+    std::chrono::steady_clock::time_point deadline;
+    // every pass runs on these threads, so their scratch buffers live on
+    std::unique_ptr<ThreadPool> pool;
+    // where the framebuffer being rendered sits in the image
+    int rowOffset{ 0 };
+    int imageHeight{ 0 };
+
+    RenderStats renderPasses(Framebuffer& fb, int firstPass, bool reportPasses);
+    int passTarget(int pass) const;
+    bool shouldStop() const;
+    bool needsSamples(const Framebuffer& fb, int x, int y) const;
+    unsigned long long renderPass(Framebuffer& fb, int targetSamples, bool adaptive, bool interruptible);
+    glm::vec3 shade(const Hit& hit, bool intersected, int x, int y, uint32_t sample, AovSample& aov) const;
+public:
+    Renderer() = delete;
+    Renderer(SceneParser& scene, const RenderSettings& settings);
+
+    // reseeds the sampler, e.g. for the next frame of a sequence
+    void setSeed(uint32_t seed);
+
+    // called after every completed pass with the current accumulation state
+    void setPassCallback(const PassCallback& callback) { passCallback = callback; }
+
+    // safe to call from another thread or a signal handler
+    void cancel() { cancelled = true; }
+
+    // firstPass > 0 continues a render whose framebuffer already holds the
+    // result of that many passes, e.g. one loaded from a checkpoint
+    RenderStats render(Framebuffer& fb, int firstPass = 0);
+
+    // renders a width x height image as bands of bandHeight rows from the
+    // top down, each with all of its passes, and hands every finished band
+    // to callback; only one band is held at a time. The time budget covers
+    // the whole image and the pass callback is not called.
+    RenderStats renderBands(int width, int height, int bandHeight, const BandCallback& callback);
+};
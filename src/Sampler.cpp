@@ -0,0 +1,130 @@
+#include <cmath>
+
+#include "Sampler.h"
+
+// some helper functions for the counter based hashing
+
+static inline uint32_t mix32(uint32_t x)
+{
+    // lowbias32 by Chris Wellons
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint32_t hashCombine(uint32_t seed, uint32_t v)
+{
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+static inline uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// maps the 24 high bits to [0, 1) so the result never rounds up to 1
+static inline float toUnitFloat(uint32_t bits)
+{
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// first two dimensions of the Sobol sequence; the second one's generator
+// matrix is the binary Pascal matrix, v[i] = v[i-1] ^ (v[i-1] >> 1)
+static inline uint32_t sobol(uint32_t index, uint32_t dim)
+{
+    if (dim == 0)
+    {
+        return reverseBits(index);
+    }
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1)
+        {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+// interleaved gradient noise (Jimenez 2014)
+static inline float gradientNoise(int x, int y)
+{
+    float f = 0.06711056f * x + 0.00583715f * y;
+    f = 52.9829189f * (f - floorf(f));
+    return f - floorf(f);
+}
+
+float Sampler::get1D(int x, int y, uint32_t sample, uint32_t dim) const
+{
+    uint32_t pixelHash = mix32(hashCombine(hashCombine(seed, (uint32_t)x), (uint32_t)y));
+
+    switch (type)
+    {
+    case SamplerType::Sobol:
+    {
+        // each pair of dimensions is a separately shuffled (0, 2) sequence
+        uint32_t index = nestedUniformScramble(sample, mix32(hashCombine(pixelHash, dim / 2)));
+        uint32_t bits = sobol(index, dim % 2);
+        return toUnitFloat(nestedUniformScramble(bits, mix32(hashCombine(pixelHash, dim + 0x5bd1e995u))));
+    }
+    case SamplerType::BlueNoise:
+    {
+        // R2 sequence, the plastic number generalisation of the golden ratio
+        static const double alpha[2] = { 0.7548776662466927, 0.5698402909980532 };
+        // the per dimension shift is the same for every pixel, so the
+        // spatial structure of the noise stays intact
+        float shift = toUnitFloat(mix32(hashCombine(seed, dim)));
+        // offsetting the noise per dimension keeps x and y decorrelated
+        double v = gradientNoise(x + 47 * (int)dim, y + 17 * (int)dim) + shift + alpha[dim % 2] * (double)sample;
+        return (float)(v - floor(v));
+    }
+    case SamplerType::Random:
+    default:
+        return toUnitFloat(mix32(hashCombine(hashCombine(pixelHash, sample), dim)));
+    }
+}
+
+bool Sampler::parseType(const std::string& name, SamplerType& type)
+{
+    if (name == "sobol")
+    {
+        type = SamplerType::Sobol;
+    }
+    else if (name == "bluenoise")
+    {
+        type = SamplerType::BlueNoise;
+    }
+    else if (name == "random")
+    {
+        type = SamplerType::Random;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
+
+enum class SamplerType
+{
+    Random,
+    Sobol,
+    BlueNoise
+};
+
+// Where each consumer reads its random numbers from. Every 2D decision takes
+// a pair of consecutive dimensions so it lands on one 2D Sobol projection.
+enum SampleDimension : uint32_t
+{
+    DimPixel = 0,     // subpixel jitter, x and y
+    DimLight = 2,     // light position / light selection
+    DimBounce = 4     // first bounce, each further bounce adds 2
+};
+
+inline uint32_t bounceDimension(int depth)
+{
+    return DimBounce + 2 * (uint32_t)depth;
+}
+
+// Stateless sampler: every value is a pure function of
+// (pixel, sample index, dimension, seed), so threads share no state and an
+// image comes out bit-identical whatever the thread count or tile order.
+//
+// Sobol   - Owen-scrambled Sobol (0, 2) pairs with per-pixel hashed
+//           scrambles and index shuffling (Burley 2020)
+// BlueNoise - R2 sequence over the samples of a pixel, offset per pixel by
+//           interleaved gradient noise so the residual error is spread as
+//           high frequency noise across the screen
+// Random  - plain hash of the counter, mostly useful as a reference
+class Sampler
+{
+    SamplerType type;
+    uint32_t seed;
+public:
+    Sampler(SamplerType type = SamplerType::Sobol, uint32_t seed = 0) : type(type), seed(seed) {}
+
+    SamplerType getType() const { return type; }
+    uint32_t getSeed() const { return seed; }
+
+    float get1D(int x, int y, uint32_t sample, uint32_t dim) const;
+
+    // dimensions dim and dim + 1
+    glm::vec2 get2D(int x, int y, uint32_t sample, uint32_t dim) const
+    {
+        return glm::vec2(get1D(x, y, sample, dim), get1D(x, y, sample, dim + 1));
+    }
+
+    static bool parseType(const std::string& name, SamplerType& type);
+};
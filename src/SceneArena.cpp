@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+#include "SceneArena.h"
+
+// std::max takes it by reference
+const size_t SceneArena::BlockSize;
+
+SceneArena::~SceneArena()
+{
+    for (auto it = finalizers.rbegin(); it != finalizers.rend(); ++it)
+    {
+        it->destroy(it->object);
+    }
+}
+
+void* SceneArena::allocate(size_t size, size_t alignment)
+{
+    if (!blocks.empty())
+    {
+        Block& block = blocks.back();
+        uintptr_t start = (uintptr_t)block.data.get() + block.used;
+        size_t padding = (alignment - start % alignment) % alignment;
+        // written so that no huge size can wrap around
+        if (padding <= block.size - block.used && size <= block.size - block.used - padding)
+        {
+            block.used += padding + size;
+            bytes += size;
+            return (void*)(start + padding);
+        }
+    }
+    if (size > std::numeric_limits<size_t>::max() - alignment)
+    {
+        throw std::bad_alloc();
+    }
+    // objects bigger than a block get a block of their own
+    Block block;
+    block.size = std::max(BlockSize, size + alignment);
+    block.data.reset(new unsigned char[block.size]);
+    uintptr_t start = (uintptr_t)block.data.get();
+    size_t padding = (alignment - start % alignment) % alignment;
+    block.used = padding + size;
+    blocks.push_back(std::move(block));
+    bytes += size;
+    return (void*)(start + padding);
+}
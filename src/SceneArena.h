@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator that owns everything a scene is built from: objects,
+// materials, lights, the camera and the child arrays of groups.
+//
+// The parser creates objects in the order it reads them, which is the
+// order a ray walks the tree, so siblings end up next to each other in
+// memory. Nothing is freed on its own; destroying the arena runs the
+// destructors that need running, newest first, and releases the blocks in
+// one go.
+class SceneArena
+{
+    struct Block
+    {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+        size_t used;
+    };
+
+    struct Finalizer
+    {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    std::vector<Block> blocks;
+    std::vector<Finalizer> finalizers;
+    size_t bytes{ 0 };
+
+    static const size_t BlockSize = 64 << 10;
+
+    void* allocate(size_t size, size_t alignment);
+public:
+    SceneArena() {}
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+    ~SceneArena();
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            finalizers.push_back({ object, [](void* o) { static_cast<T*>(o)->~T(); } });
+        }
+        return object;
+    }
+
+    // count zeroed elements; only for plain data like pointers
+    template <typename T>
+    T* createArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+        if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+        {
+            throw std::bad_alloc();
+        }
+        T* array = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; i++)
+        {
+            new (array + i) T();
+        }
+        return array;
+    }
+
+    // bytes handed out so far
+    size_t getBytes() const
+    {
+        return bytes;
+    }
+};
@@ -1,42 +1,72 @@
+#include <charconv>
 #include <string>
 
 #include <glm/glm.hpp>
 
 #include "SceneParser.h"
 
-#include "Camera.h" 
+#include "Camera.h"
 #include "Light.h"
 #include "Material.h"
 
 #include "Object3D.h"
-#include "Group.h" 
+#include "Group.h"
 #include "Sphere.h"
 #include "Plane.h"
 #include "Triangle.h"
 #include "Transform.h"
 
-#include <fstream>
+namespace {
+    // thrown by error() once the message is out, caught by the constructor
+    struct ParseError {};
+}
 
 SceneParser::SceneParser(const std::string& filename) {
     // parse the file
     assert(filename.size() != 0);
     std::cout << "scene file name: " << filename << std::endl;
-    const std::string ext = filename.substr(filename.size() - 4, 4);
+    const std::string snapshotExt = ".snapshot";
+    if (filename.size() > snapshotExt.size() &&
+        filename.compare(filename.size() - snapshotExt.size(), snapshotExt.size(), snapshotExt) == 0) {
+        if (!loadSceneSnapshot(filename, *this)) {
+            std::cerr << filename << ": error: cannot open scene snapshot" << std::endl;
+            exit(1);
+        }
+        return;
+    }
+    const std::string ext = filename.size() >= 4 ? filename.substr(filename.size() - 4, 4) : "";
 
     if (ext != ".txt") {
-        printf("wrong file name extension\n");
-        exit(0);
+        std::cerr << filename << ": error: wrong file name extension, expected .txt or .snapshot" << std::endl;
+        exit(1);
     }
-    file = fopen(filename.c_str(), "r");
-
-    if (file == NULL) {
-        std::cerr << filename << ": " << std::strerror(errno) << std::endl;
-        printf("cannot open scene file\n");
-        exit(0);
+    this->filename = filename;
+    if (!file.open(filename, MappedFile::Sequential)) {
+        std::cerr << filename << ": error: cannot open scene file" << std::endl;
+        exit(1);
+    }
+    cursor = (const char*)file.data();
+    end = cursor + file.size();
+    line_start = cursor;
+    bool failed = false;
+    {
+        ThreadPool pool(0);
+        loader = &pool;
+        try {
+            parseFile();
+            file.close();
+            finishLoading();
+        }
+        catch (const ParseError&) {
+            failed = true;
+        }
+        loader = nullptr;
+    }
+    // the pool has finished the mesh loads it was given by now, so nothing
+    // is left running on the caches exit() tears down
+    if (failed) {
+        exit(1);
     }
-    parseFile();
-    fclose(file);
-    file = NULL;
 
     // if no lights are specified, set ambient light to white
     // (do solid color ray casting)
@@ -47,19 +77,7 @@ SceneParser::SceneParser(const std::string& filename) {
 }
 
 SceneParser::~SceneParser() {
-    if (group != NULL)
-        delete group;
-    if (camera != NULL)
-        delete camera;
-    int i;
-    for (i = 0; i < num_materials; i++) {
-        delete materials[i];
-    }
-    delete[] materials;
-    for (i = 0; i < num_lights; i++) {
-        delete lights[i];
-    }
-    delete[] lights;
+    // everything the scene is made of goes away with the arena
 }
 
 // ====================================================================
@@ -67,30 +85,29 @@ SceneParser::~SceneParser() {
 
 void SceneParser::parseFile() {
     //
-    // at the top level, the scene can have a camera, 
+    // at the top level, the scene can have a camera,
     // background color and a group of objects
     // (we add lights and other things in future assignments)
     //
-    char token[MAX_PARSER_TOKEN_LENGTH];
+    SceneToken token;
     while (getToken(token)) {
-        if (!strcmp(token, "PerspectiveCamera")) {
+        if (token == "PerspectiveCamera") {
             parsePerspectiveCamera();
         }
-        else if (!strcmp(token, "Background")) {
+        else if (token == "Background") {
             parseBackground();
         }
-        else if (!strcmp(token, "Lights")) {
+        else if (token == "Lights") {
             parseLights();
         }
-        else if (!strcmp(token, "Materials")) {
+        else if (token == "Materials") {
             parseMaterials();
         }
-        else if (!strcmp(token, "Group")) {
+        else if (token == "Group") {
             group = parseGroup();
         }
         else {
-            printf("Unknown token in parseFile: '%s'\n", token);
-            exit(0);
+            error(token, "unknown token '" + token.str() + "'");
         }
     }
 }
@@ -99,151 +116,154 @@ void SceneParser::parseFile() {
 // ====================================================================
 
 void SceneParser::parsePerspectiveCamera() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
     // read in the camera parameters
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token); assert(!strcmp(token, "center"));
+    expect("{");
+    expect("center");
     glm::vec3 center = readVec3();
-    getToken(token); assert(!strcmp(token, "direction"));
+    expect("direction");
     glm::vec3 direction = readVec3();
-    getToken(token); assert(!strcmp(token, "up"));
+    expect("up");
     glm::vec3 up = readVec3();
-    getToken(token); assert(!strcmp(token, "angle"));
+    expect("angle");
     float angle_degrees = readFloat();
     float angle_radians = glm::radians(angle_degrees);
-    getToken(token); assert(!strcmp(token, "aspectRatio"));
+    expect("aspectRatio");
     float aspectRatio = readFloat();
-    getToken(token); assert(!strcmp(token, "}"));
-    camera = new PerspectiveCamera(center, direction, up, angle_radians, (float) aspectRatio);
+    expect("}");
+    camera = arena.create<PerspectiveCamera>(center, direction, up, angle_radians, (float) aspectRatio);
+    SnapshotCamera& record_camera = record.camera;
+    record_camera.valid = 1;
+    for (int i = 0; i < 3; i++) {
+        record_camera.center[i] = center[i];
+        record_camera.direction[i] = direction[i];
+        record_camera.up[i] = up[i];
+    }
+    record_camera.fovy = angle_radians;
+    record_camera.aspectRatio = aspectRatio;
 }
 
 void SceneParser::parseBackground() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
     // read in the background color
-    getToken(token); assert(!strcmp(token, "{"));
+    expect("{");
     while (1) {
-        getToken(token);
-        if (!strcmp(token, "}")) {
+        SceneToken token = nextToken("'}'");
+        if (token == "}") {
             break;
         }
-        else if (!strcmp(token, "color")) {
+        else if (token == "color") {
             background_color = readVec3();
         }
-        else if (!strcmp(token, "ambientLight")) {
+        else if (token == "ambientLight") {
             ambient_light = readVec3();
         }
         else {
-            printf("Unknown token in parseBackground: '%s'\n", token);
-            assert(0);
+            error(token, "unknown token '" + token.str() + "' in Background");
         }
     }
 }
 
 void SceneParser::parseLights() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
+    expect("{");
     // read in the number of objects
-    getToken(token); assert(!strcmp(token, "numLights"));
-    num_lights = readInt();
-    lights = new Light * [num_lights];
+    expect("numLights");
+    num_lights = readCount();
+    lights = arena.createArray<Light*>(num_lights);
     // read in the objects
     int count = 0;
     while (num_lights > count) {
-        getToken(token);
-        if (!strcmp(token, "DirectionalLight")) {
+        SceneToken token = nextToken("a light");
+        if (token == "DirectionalLight") {
             lights[count] = parseDirectionalLight();
         }
-        else if (strcmp(token, "PointLight") == 0)
+        else if (token == "PointLight")
         {
             lights[count] = parsePointLight();
         }
         else {
-            printf("Unknown token in parseLight: '%s'\n", token);
-            exit(0);
+            error(token, "unknown light '" + token.str() + "'");
         }
         count++;
     }
-    getToken(token); assert(!strcmp(token, "}"));
+    expect("}");
 }
 
 
 Light* SceneParser::parseDirectionalLight() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token); assert(!strcmp(token, "direction"));
+    expect("{");
+    expect("direction");
     glm::vec3 direction = readVec3();
-    getToken(token); assert(!strcmp(token, "color"));
+    expect("color");
     glm::vec3 color = readVec3();
-    getToken(token); assert(!strcmp(token, "}"));
-    return new DirectionalLight(direction, color);
+    expect("}");
+    recordLight(SnapshotDirectionalLight, direction, color);
+    return arena.create<DirectionalLight>(direction, color);
 }
 Light* SceneParser::parsePointLight() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token); assert(!strcmp(token, "position"));
+    expect("{");
+    expect("position");
     glm::vec3 position = readVec3();
-    getToken(token); assert(!strcmp(token, "color"));
+    expect("color");
     glm::vec3 color = readVec3();
-    getToken(token); assert(!strcmp(token, "}"));
-    return new PointLight(position, color);
+    expect("}");
+    recordLight(SnapshotPointLight, position, color);
+    return arena.create<PointLight>(position, color);
 }
 // ====================================================================
 // ====================================================================
 
 void SceneParser::parseMaterials() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
+    expect("{");
     // read in the number of objects
-    getToken(token); assert(!strcmp(token, "numMaterials"));
-    num_materials = readInt();
-    materials = new Material * [num_materials];
+    expect("numMaterials");
+    num_materials = readCount();
+    materials = arena.createArray<Material*>(num_materials);
     // read in the objects
     int count = 0;
     while (num_materials > count) {
-        getToken(token);
-        if (!strcmp(token, "Material") ||
-            !strcmp(token, "PhongMaterial")) {
+        SceneToken token = nextToken("a material");
+        if (token == "Material" ||
+            token == "PhongMaterial") {
             materials[count] = parseMaterial();
+            materials[count]->setId(count);
         }
         else {
-            printf("Unknown token in parseMaterial: '%s'\n", token);
-            exit(0);
+            error(token, "unknown material '" + token.str() + "'");
         }
         count++;
     }
-    getToken(token); assert(!strcmp(token, "}"));
+    expect("}");
 }
 
 
 Material* SceneParser::parseMaterial() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    char filename[MAX_PARSER_TOKEN_LENGTH];
-    filename[0] = 0;
+    std::string filename;
     glm::vec3 diffuseColor(1, 1, 1), specularColor(0, 0, 0);
     float shininess = 0;
-    getToken(token); assert(!strcmp(token, "{"));
+    expect("{");
     while (1) {
-        getToken(token);
-        if (strcmp(token, "diffuseColor") == 0) {
+        SceneToken token = nextToken("'}'");
+        if (token == "diffuseColor") {
             diffuseColor = readVec3();
         }
-        else if (strcmp(token, "specularColor") == 0) {
+        else if (token == "specularColor") {
             specularColor = readVec3();
         }
-        else if (strcmp(token, "shininess") == 0) {
+        else if (token == "shininess") {
             shininess = readFloat();
         }
-        else if (strcmp(token, "texture") == 0) {
-            getToken(filename);
+        else if (token == "texture") {
+            filename = nextToken("a texture file name").str();
         }
-        else {
-            assert(!strcmp(token, "}"));
+        else if (token == "}") {
             break;
         }
+        else {
+            error(token, "unknown token '" + token.str() + "' in Material");
+        }
     }
-    Material* answer = new Material(diffuseColor, specularColor, shininess);
-    if (filename[0] != 0) {
-        answer->loadTexture(filename);
+    Material* answer = arena.create<Material>(diffuseColor, specularColor, shininess);
+    if (!filename.empty()) {
+        answer->loadTexture(filename.c_str());
     }
     return answer;
 }
@@ -251,29 +271,28 @@ Material* SceneParser::parseMaterial() {
 // ====================================================================
 // ====================================================================
 
-Object3D* SceneParser::parseObject(char token[MAX_PARSER_TOKEN_LENGTH]) {
+Object3D* SceneParser::parseObject(const SceneToken& token) {
     Object3D* answer = NULL;
-    if (!strcmp(token, "Group")) {
+    if (token == "Group") {
         answer = (Object3D*)parseGroup();
     }
-    else if (!strcmp(token, "Sphere")) {
+    else if (token == "Sphere") {
         answer = (Object3D*)parseSphere();
     }
-    else if (!strcmp(token, "Plane")) {
+    else if (token == "Plane") {
         answer = (Object3D*)parsePlane();
     }
-    else if (!strcmp(token, "Triangle")) {
+    else if (token == "Triangle") {
         answer = (Object3D*)parseTriangle();
     }
-    else if (!strcmp(token, "TriangleMesh")) {
+    else if (token == "TriangleMesh") {
         answer = (Object3D*)parseTriangleMesh();
     }
-    else if (!strcmp(token, "Transform")) {
+    else if (token == "Transform") {
         answer = (Object3D*)parseTransform();
     }
     else {
-        printf("Unknown token in parseObject: '%s'\n", token);
-        exit(0);
+        error(token, "unknown object '" + token.str() + "'");
     }
     return answer;
 }
@@ -290,34 +309,35 @@ Group* SceneParser::parseGroup() {
     // until the next material index (scoping for the materials is very
     // simple, and essentially ignores any tree hierarchy)
     //
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
+    expect("{");
 
     // read in the number of objects
-    getToken(token); assert(!strcmp(token, "numObjects"));
-    int num_objects = readInt();
+    expect("numObjects");
+    int num_objects = readCount();
 
-    Group* answer = new Group(num_objects);
+    Group* answer = arena.create<Group>(num_objects, arena.createArray<Object3D*>(num_objects));
+    recordObject(SnapshotGroup, num_objects);
 
     // read in the objects
     int count = 0;
     while (num_objects > count) {
-        getToken(token);
-        if (!strcmp(token, "MaterialIndex")) {
+        SceneToken token = nextToken("an object");
+        if (token == "MaterialIndex") {
             // change the current material
             int index = readInt();
-            assert(index >= 0 && index <= getNumMaterials());
+            if (index < 0 || index >= getNumMaterials()) {
+                error(token, "material index " + std::to_string(index) + " out of range");
+            }
             current_material = getMaterial(index);
         }
         else {
             Object3D* object = parseObject(token);
-            assert(object != NULL);
             answer->addObject(count, object);
 
             count++;
         }
     }
-    getToken(token); assert(!strcmp(token, "}"));
+    expect("}");
 
     // return the group
     return answer;
@@ -327,184 +347,294 @@ Group* SceneParser::parseGroup() {
 // ====================================================================
 
 Sphere* SceneParser::parseSphere() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token); assert(!strcmp(token, "center"));
+    expect("{");
+    expect("center");
     glm::vec3 center = readVec3();
-    getToken(token); assert(!strcmp(token, "radius"));
+    expect("radius");
     float radius = readFloat();
-    getToken(token); assert(!strcmp(token, "}"));
-    assert(current_material != NULL);
-    return new Sphere(center, radius, current_material);
+    SceneToken close = expect("}");
+    if (current_material == NULL) {
+        error(close, "Sphere without a MaterialIndex");
+    }
+    recordObject(SnapshotSphere, 0, &center[0], 3).params[3] = radius;
+    return arena.create<Sphere>(center, radius, current_material);
 }
 
 
 Plane* SceneParser::parsePlane() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token); assert(!strcmp(token, "normal"));
+    expect("{");
+    expect("normal");
     glm::vec3 normal = readVec3();
-    getToken(token); assert(!strcmp(token, "offset"));
+    expect("offset");
     float offset = readFloat();
-    getToken(token); assert(!strcmp(token, "}"));
-    assert(current_material != NULL);
-    return new Plane(normal, offset, current_material);
+    SceneToken close = expect("}");
+    if (current_material == NULL) {
+        error(close, "Plane without a MaterialIndex");
+    }
+    recordObject(SnapshotPlane, 0, &normal[0], 3).params[3] = offset;
+    return arena.create<Plane>(normal, offset, current_material);
 }
 
 
 Triangle* SceneParser::parseTriangle() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token);
-    assert(!strcmp(token, "vertex0"));
+    expect("{");
+    expect("vertex0");
     glm::vec3 v0 = readVec3();
-    getToken(token);
-    assert(!strcmp(token, "vertex1"));
+    expect("vertex1");
     glm::vec3 v1 = readVec3();
-    getToken(token);
-    assert(!strcmp(token, "vertex2"));
+    expect("vertex2");
     glm::vec3 v2 = readVec3();
-    getToken(token); assert(!strcmp(token, "}"));
-    assert(current_material != NULL);
-    return new Triangle(v0, v1, v2, current_material);
+    SceneToken close = expect("}");
+    if (current_material == NULL) {
+        error(close, "Triangle without a MaterialIndex");
+    }
+    SnapshotObject& record_triangle = recordObject(SnapshotTriangle, 0);
+    for (int i = 0; i < 3; i++) {
+        record_triangle.params[i] = v0[i];
+        record_triangle.params[3 + i] = v1[i];
+        record_triangle.params[6 + i] = v2[i];
+    }
+    return arena.create<Triangle>(v0, v1, v2, current_material);
 }
 
-Mesh* SceneParser::parseTriangleMesh() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
-    char filename[MAX_PARSER_TOKEN_LENGTH];
+Object3D* SceneParser::parseTriangleMesh() {
     // get the filename
-    getToken(token); assert(!strcmp(token, "{"));
-    getToken(token); assert(!strcmp(token, "obj_file"));
-    getToken(filename);
-    getToken(token); assert(!strcmp(token, "}"));
-    const char* ext = &filename[strlen(filename) - 4];
-    assert(!strcmp(ext, ".obj"));
-    Mesh* answer = new Mesh(filename, current_material);
+    expect("{");
+    expect("obj_file");
+    SceneToken name = nextToken("an OBJ file name");
+    expect("}");
+    std::string filename = name.str();
+    if (filename.size() < 4 || filename.compare(filename.size() - 4, 4, ".obj") != 0) {
+        error(name, "mesh file " + filename + " is not an .obj");
+    }
+    GeometryStreamer& streamer = GeometryStreamer::instance();
+    if (streamer.isEnabled()) {
+        // streamed meshes need the bounds from an up to date mesh cache
+        StreamedGeometry* geometry = streamer.getGeometry(filename);
+        if (geometry == NULL && convertMesh(filename)) {
+            geometry = streamer.getGeometry(filename);
+        }
+        if (geometry != NULL) {
+            recordObject(SnapshotMesh, 0);
+            return arena.create<LazyMesh>(geometry, current_material);
+        }
+    }
+    // the data arrives in finishLoading()
+    Mesh* answer = arena.create<Mesh>(current_material);
+    MeshLoad load = { answer, GeometryCache::instance().requestMesh(filename, *loader), record.objects.size() };
+    mesh_loads.push_back(load);
+    recordObject(SnapshotMesh, 0);
 
     return answer;
 }
 
 
 Transform* SceneParser::parseTransform() {
-    char token[MAX_PARSER_TOKEN_LENGTH];
     glm::mat4 matrix = glm::mat4(1.0f);
     Object3D* object = NULL;
-    getToken(token); assert(!strcmp(token, "{"));
-    // read in transformations: 
+    expect("{");
+    // read in transformations:
     // apply to the LEFT side of the current matrix (so the first
     // transform in the list is the last applied to the object)
-    getToken(token);
+    SceneToken token = nextToken("a transformation or an object");
 
     while (1) {
-        if (!strcmp(token, "Scale")) {
+        if (token == "Scale") {
             glm::vec3 s = readVec3();
             matrix = glm::scale(matrix, s);
         }
-        else if (!strcmp(token, "UniformScale")) {
+        else if (token == "UniformScale") {
             float s = readFloat();
             matrix = glm::scale(matrix, glm::vec3(s));
         }
-        else if (!strcmp(token, "Translate")) {
+        else if (token == "Translate") {
             matrix = glm::translate(matrix, readVec3());
         }
-        else if (!strcmp(token, "XRotate")) {
+        else if (token == "XRotate") {
             matrix = glm::rotate(matrix, glm::radians(readFloat()), glm::vec3(1, 0, 0));
         }
-        else if (!strcmp(token, "YRotate")) {
+        else if (token == "YRotate") {
             matrix = glm::rotate(matrix, glm::radians(readFloat()), glm::vec3(0, 1, 0));
         }
-        else if (!strcmp(token, "ZRotate")) {
+        else if (token == "ZRotate") {
             matrix = glm::rotate(matrix, glm::radians(readFloat()), glm::vec3(0, 0, 1));
         }
-        else if (!strcmp(token, "Rotate")) {
-            getToken(token); assert(!strcmp(token, "{"));
+        else if (token == "Rotate") {
+            expect("{");
             glm::vec3 axis = readVec3();
             float degrees = readFloat();
-            float radians = glm::radians(degrees);
             matrix = glm::rotate(matrix, glm::radians(degrees), axis);
-            getToken(token); assert(!strcmp(token, "}"));
+            expect("}");
         }
-        else if (!strcmp(token, "Matrix4f")) {
+        else if (token == "Matrix4f") {
             glm::mat4 matrix2 = glm::mat4(1.0f);
-            getToken(token); assert(!strcmp(token, "{"));
+            expect("{");
             for (int j = 0; j < 4; j++) {
                 for (int i = 0; i < 4; i++) {
                     float v = readFloat();
                     matrix2[i][j] = v;
                 }
             }
-            getToken(token); assert(!strcmp(token, "}"));
+            expect("}");
             // column major!! => hence the order :)
             matrix = matrix * matrix2;
         }
         else {
             // otherwise this must be an object,
             // and there are no more transformations
+            recordObject(SnapshotTransform, 1, &matrix[0][0], 16);
             object = parseObject(token);
             break;
         }
-        getToken(token);
+        token = nextToken("a transformation or an object");
+    }
+
+    expect("}");
+    return arena.create<Transform>(matrix, object);
+}
+
+void SceneParser::finishLoading() {
+    for (MeshLoad& load : mesh_loads) {
+        load.mesh->data = load.data.get();
+        // references to one file share its data, and a snapshot stores it once
+        size_t mesh = 0;
+        while (mesh < record.meshes.size() && record.meshes[mesh]->data != load.mesh->data) {
+            mesh++;
+        }
+        if (mesh == record.meshes.size()) {
+            record.meshes.push_back(load.mesh);
+        }
+        record.objects[load.object].mesh = (int32_t)mesh;
     }
+    mesh_loads.clear();
+}
+
+// ====================================================================
+// ====================================================================
+
+SnapshotObject& SceneParser::recordObject(int type, int children, const float* params, int numParams) {
+    SnapshotObject object;
+    memset(&object, 0, sizeof(object));
+    object.type = type;
+    object.material = current_material != NULL ? current_material->getId() : -1;
+    object.children = children;
+    object.mesh = -1;
+    for (int i = 0; i < numParams; i++) {
+        object.params[i] = params[i];
+    }
+    record.objects.push_back(object);
+    return record.objects.back();
+}
 
-    assert(object != NULL);
-    getToken(token); assert(!strcmp(token, "}"));
-    return new Transform(matrix, object);
+void SceneParser::recordLight(int type, const glm::vec3& vector, const glm::vec3& color) {
+    SnapshotLight light;
+    light.type = type;
+    for (int i = 0; i < 3; i++) {
+        light.vector[i] = vector[i];
+        light.color[i] = color[i];
+    }
+    record.lights.push_back(light);
 }
 
 // ====================================================================
 // ====================================================================
 
-int SceneParser::getToken(char token[MAX_PARSER_TOKEN_LENGTH]) {
+bool SceneParser::getToken(SceneToken& token) {
     // for simplicity, tokens must be separated by whitespace
-    assert(file != NULL);
-    int success = fscanf(file, "%s ", token);
-    if (success == EOF) {
-        token[0] = '\0';
-        return 0;
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) {
+        if (*cursor == '\n') {
+            line++;
+            line_start = cursor + 1;
+        }
+        cursor++;
     }
-    return 1;
+    token.text = cursor;
+    token.line = line;
+    token.column = (int)(cursor - line_start) + 1;
+    while (cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n') {
+        cursor++;
+    }
+    token.length = cursor - token.text;
+    return token.length > 0;
 }
 
+SceneToken SceneParser::nextToken(const char* what) {
+    SceneToken token;
+    if (!getToken(token)) {
+        error(token, std::string("expected ") + what + " before the end of the file");
+    }
+    return token;
+}
 
-glm::vec3 SceneParser::readVec3() {
-    float x, y, z;
-    int count = fscanf(file, "%f %f %f", &x, &y, &z);
-    if (count != 3) {
-        printf("Error trying to read 3 floats to make a glm::vec3\n");
-        assert(0);
+SceneToken SceneParser::expect(const char* word) {
+    SceneToken token = nextToken(("'" + std::string(word) + "'").c_str());
+    if (token != word) {
+        error(token, "expected '" + std::string(word) + "', found '" + token.str() + "'");
     }
+    return token;
+}
+
+void SceneParser::error(const SceneToken& token, const std::string& message) const {
+    std::cerr << filename << ":" << token.line << ":" << token.column << ": error: " << message << std::endl;
+    throw ParseError();
+}
+
+
+glm::vec3 SceneParser::readVec3() {
+    float x = readFloat();
+    float y = readFloat();
+    float z = readFloat();
     return glm::vec3(x, y, z);
 }
 
 
 glm::vec2 SceneParser::readVec2() {
-    float u, v;
-    int count = fscanf(file, "%f %f", &u, &v);
-    if (count != 2) {
-        printf("Error trying to read 2 floats to make a Vec2f\n");
-        assert(0);
-    }
+    float u = readFloat();
+    float v = readFloat();
     return glm::vec2(u, v);
 }
 
 
 float SceneParser::readFloat() {
-    float answer;
-    int count = fscanf(file, "%f", &answer);
-    if (count != 1) {
-        printf("Error trying to read 1 float\n");
-        assert(0);
+    SceneToken token = nextToken("a number");
+    const char* first = token.text;
+    const char* last = token.text + token.length;
+    // from_chars doesn't take the '+' fscanf did
+    if (first < last && *first == '+') {
+        first++;
+    }
+    float answer = 0.0f;
+    std::from_chars_result result = std::from_chars(first, last, answer);
+    if (result.ec != std::errc() || result.ptr != last) {
+        error(token, "expected a number, found '" + token.str() + "'");
     }
     return answer;
 }
 
 
 int SceneParser::readInt() {
-    int answer;
-    int count = fscanf(file, "%d", &answer);
-    if (count != 1) {
-        printf("Error trying to read 1 int\n");
-        assert(0);
+    return toInt(nextToken("an integer"));
+}
+
+int SceneParser::readCount() {
+    SceneToken token = nextToken("a count");
+    int count = toInt(token);
+    if (count < 0) {
+        error(token, "expected a count, found '" + token.str() + "'");
+    }
+    return count;
+}
+
+int SceneParser::toInt(const SceneToken& token) const {
+    const char* first = token.text;
+    const char* last = token.text + token.length;
+    if (first < last && *first == '+') {
+        first++;
+    }
+    int answer = 0;
+    std::from_chars_result result = std::from_chars(first, last, answer);
+    if (result.ec != std::errc() || result.ptr != last) {
+        error(token, "expected an integer, found '" + token.str() + "'");
     }
     return answer;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include <string>
 
 #include <glm/glm.hpp>
@@ -14,8 +15,35 @@
 #include "Plane.h"
 #include "Triangle.h"
 #include "Transform.h"
+#include "SceneSnapshot.h"
+#include "MappedFile.h"
+#include "GeometryCache.h"
+#include "ThreadPool.h"
+#include "SceneArena.h"
+
+// a whitespace separated word of a scene file, pointing into the mapping
+struct SceneToken
+{
+    const char* text{ nullptr };
+    size_t length{ 0 };
+    int line{ 0 };
+    int column{ 0 };
+
+    bool operator==(const char* word) const
+    {
+        return strlen(word) == length && memcmp(word, text, length) == 0;
+    }
+
+    bool operator!=(const char* word) const
+    {
+        return !(*this == word);
+    }
 
-#define MAX_PARSER_TOKEN_LENGTH 100
+    std::string str() const
+    {
+        return std::string(text, length);
+    }
+};
 
 class SceneParser
 {
@@ -30,35 +58,79 @@ class SceneParser
     void parseMaterials();
     Material* parseMaterial();
 
-    Object3D* parseObject(char token[MAX_PARSER_TOKEN_LENGTH]);
+    Object3D* parseObject(const SceneToken& token);
     Group* parseGroup();
     Sphere* parseSphere();
     Plane* parsePlane();
     Triangle* parseTriangle();
-    Mesh* parseTriangleMesh();
+    Object3D* parseTriangleMesh();
     Transform* parseTransform();
 
-    int getToken(char token[MAX_PARSER_TOKEN_LENGTH]);
+    SnapshotObject& recordObject(int type, int children, const float* params = nullptr, int numParams = 0);
+    void recordLight(int type, const glm::vec3& vector, const glm::vec3& color);
+
+    // Meshes load (and build their BVH) on a thread pool while parsing goes
+    // on; finishLoading() waits for them all before the scene is handed out.
+    struct MeshLoad
+    {
+        Mesh* mesh;
+        GeometryCache::PendingMesh data;
+        size_t object;      // its entry in record.objects
+    };
+    void finishLoading();
+
+    // The scene file is mapped and split into tokens in place; numbers are
+    // converted with from_chars straight from the mapping. Any error names
+    // the file, line and column and ends the program once the mesh loads
+    // already started have finished.
+    bool getToken(SceneToken& token);
+    SceneToken nextToken(const char* what);
+    SceneToken expect(const char* word);
+    [[noreturn]] void error(const SceneToken& token, const std::string& message) const;
     glm::vec3 readVec3();
     glm::vec2 readVec2();
     float readFloat();
     int readInt();
-
-    FILE* file;
+    // a non-negative integer, for the sizes of lists
+    int readCount();
+    int toInt(const SceneToken& token) const;
+
+    // owns everything the pointers below point to; declared first so it is
+    // destroyed last
+    SceneArena arena;
+
+    std::string filename;
+    MappedFile file;
+    const char* cursor{nullptr};
+    const char* end{nullptr};
+    const char* line_start{nullptr};
+    int line{1};
+    ThreadPool* loader{nullptr};
+    std::vector<MeshLoad> mesh_loads;
     Camera* camera{nullptr};
     glm::vec3 background_color{ glm::vec3(0.5, 0.5, 0.5) };
     glm::vec3 ambient_light{ glm::vec3(0, 0, 0) };
-    int num_lights;
+    int num_lights{0};
     Light** lights{nullptr};
     int num_materials{0};
     Material** materials{nullptr};
     Material* current_material{nullptr};
     Group* group{nullptr};
+
+    // what was parsed, for writeSceneSnapshot()
+    SceneRecord record;
+    friend bool loadSceneSnapshot(const std::string& filename, SceneParser& scene);
 public:
 
+    // filename is a text scene (.txt) or a scene snapshot (.snapshot)
     SceneParser(const std::string& filename);
     ~SceneParser();
 
+    const SceneRecord& getRecord() const
+    {
+        return record;
+    }
+
     Camera* getCamera() const
     {
         return camera;
@@ -100,4 +172,10 @@ public:
     {
         return group;
     }
+
+    // where the scene's objects live; loaders build into it
+    SceneArena& getArena()
+    {
+        return arena;
+    }
 };
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "SceneSnapshot.h"
+#include "SceneParser.h"
+
+namespace
+{
+    const uint32_t SnapshotVersion = 4;
+    const size_t SectionAlignment = 64;
+
+    struct SnapshotMaterial
+    {
+        float diffuse[3];
+        float specular[3];
+        float shininess;
+        int32_t texture;    // index into the texture table, -1 for none
+    };
+
+    // a mesh image (see encodeMeshImage()) or a texture's tiles
+    struct SnapshotBlob
+    {
+        uint64_t offset;
+        uint64_t size;
+        int32_t width;      // textures only
+        int32_t height;
+    };
+
+    struct SceneSnapshotHeader
+    {
+        char magic[8];      // "SRTSCENE"
+        uint32_t version;
+        uint32_t objectSize;    // layout check, like the mesh cache's
+        SnapshotCamera camera;
+        float background[3];
+        float ambient[3];
+        uint32_t lightCount;
+        uint32_t materialCount;
+        uint32_t objectCount;
+        uint32_t meshCount;
+        uint32_t textureCount;
+        uint32_t reserved;
+        uint64_t lightOffset;
+        uint64_t materialOffset;
+        uint64_t objectOffset;
+        uint64_t meshOffset;
+        uint64_t textureOffset;
+    };
+
+    void toFloats(const glm::vec3& v, float* out)
+    {
+        out[0] = v[0];
+        out[1] = v[1];
+        out[2] = v[2];
+    }
+
+    glm::vec3 fromFloats(const float* p)
+    {
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+
+    // appends 64 byte aligned sections to a file, keeping track of offsets
+    struct SnapshotFile
+    {
+        FILE* file{ nullptr };
+        uint64_t position{ 0 };
+        bool ok{ true };
+
+        uint64_t append(const void* data, size_t bytes)
+        {
+            static const char zeros[SectionAlignment] = {};
+            size_t padding = (size_t)((SectionAlignment - position % SectionAlignment) % SectionAlignment);
+            ok = ok && fwrite(zeros, 1, padding, file) == padding;
+            position += padding;
+            uint64_t offset = position;
+            ok = ok && (bytes == 0 || fwrite(data, 1, bytes, file) == bytes);
+            position += bytes;
+            return offset;
+        }
+    };
+
+    bool tableFits(uint64_t offset, uint64_t count, size_t elementSize, size_t fileSize)
+    {
+        return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+    }
+
+    // builds the subtree starting at objects[index], advancing index past it
+    Object3D* buildObject(const SnapshotObject* objects, size_t count, size_t& index,
+                          const std::shared_ptr<MappedFile>& file, const SnapshotBlob* meshBlobs, uint32_t meshCount,
+                          SceneParser& scene, std::vector<Mesh*>& meshes)
+    {
+        if (index >= count)
+        {
+            return nullptr;
+        }
+        const SnapshotObject& o = objects[index++];
+        Material* material = nullptr;
+        if (o.material >= 0)
+        {
+            if (o.material >= scene.getNumMaterials())
+            {
+                return nullptr;
+            }
+            material = scene.getMaterial(o.material);
+        }
+        const float* p = o.params;
+        switch (o.type)
+        {
+        case SnapshotGroup:
+        {
+            // every child takes at least one entry
+            if (o.children > count - index)
+            {
+                return nullptr;
+            }
+            Group* group = scene.getArena().create<Group>(o.children, scene.getArena().createArray<Object3D*>(o.children));
+            for (uint32_t i = 0; i < o.children; i++)
+            {
+                Object3D* child = buildObject(objects, count, index, file, meshBlobs, meshCount, scene, meshes);
+                if (child == nullptr)
+                {
+                    return nullptr;
+                }
+                group->addObject(i, child);
+            }
+            return group;
+        }
+        case SnapshotSphere:
+            return scene.getArena().create<Sphere>(fromFloats(p), p[3], material);
+        case SnapshotPlane:
+            return scene.getArena().create<Plane>(fromFloats(p), p[3], material);
+        case SnapshotTriangle:
+            return scene.getArena().create<Triangle>(fromFloats(p), fromFloats(p + 3), fromFloats(p + 6), material);
+        case SnapshotMesh:
+        {
+            if (o.mesh < 0 || (uint32_t)o.mesh >= meshCount)
+            {
+                return nullptr;
+            }
+            Mesh* mesh = scene.getArena().create<Mesh>(material);
+            if (meshes[o.mesh] != nullptr)
+            {
+                // another reference to a mesh that is already attached
+                mesh->data = meshes[o.mesh]->data;
+                return mesh;
+            }
+            std::shared_ptr<MeshData> data = std::make_shared<MeshData>();
+            const SnapshotBlob& blob = meshBlobs[o.mesh];
+            if (!data->attach(file, (size_t)blob.offset, (size_t)blob.size))
+            {
+                return nullptr;
+            }
+            mesh->data = data;
+            meshes[o.mesh] = mesh;
+            return mesh;
+        }
+        case SnapshotTransform:
+        {
+            glm::mat4 matrix(1.0f);
+            for (int c = 0; c < 4; c++)
+            {
+                for (int r = 0; r < 4; r++)
+                {
+                    matrix[c][r] = p[c * 4 + r];
+                }
+            }
+            Object3D* child = buildObject(objects, count, index, file, meshBlobs, meshCount, scene, meshes);
+            return child != nullptr ? scene.getArena().create<Transform>(matrix, child) : nullptr;
+        }
+        default:
+            return nullptr;
+        }
+    }
+}
+
+bool writeSceneSnapshot(const SceneParser& scene, const std::string& filename)
+{
+    const SceneRecord& record = scene.getRecord();
+    for (const SnapshotObject& o : record.objects)
+    {
+        if (o.type == SnapshotMesh && o.mesh < 0)
+        {
+            std::cerr << "writeSceneSnapshot() ERROR: the scene has streamed meshes, parse it without a geometry budget" << std::endl;
+            return false;
+        }
+    }
+    SceneSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SRTSCENE", 8);
+    header.version = SnapshotVersion;
+    header.objectSize = sizeof(SnapshotObject);
+    header.camera = record.camera;
+    toFloats(scene.getBackgroundColor(), header.background);
+    toFloats(scene.getAmbientLight(), header.ambient);
+
+    // materials that share a texture share its tiles in the file too
+    std::vector<const Texture*> textures;
+    std::vector<SnapshotMaterial> materials(scene.getNumMaterials());
+    for (int i = 0; i < scene.getNumMaterials(); i++)
+    {
+        const Material* m = scene.getMaterial(i);
+        SnapshotMaterial& out = materials[i];
+        toFloats(m->getDiffuseColor(), out.diffuse);
+        toFloats(m->getSpecularColor(), out.specular);
+        out.shininess = m->getShininess();
+        out.texture = -1;
+        const Texture* texture = m->getTexture().get();
+        if (texture != nullptr && texture->valid())
+        {
+            auto it = std::find(textures.begin(), textures.end(), texture);
+            out.texture = (int32_t)(it - textures.begin());
+            if (it == textures.end())
+            {
+                textures.push_back(texture);
+            }
+        }
+    }
+
+    // a damaged mesh cache must not be baked into the snapshot
+    for (const Mesh* mesh : record.meshes)
+    {
+        if (!mesh->data->verify())
+        {
+            std::cerr << "writeSceneSnapshot() ERROR: a mesh has out of range indices" << std::endl;
+            return false;
+        }
+    }
+
+    std::string temporary = filename + ".tmp";
+    SnapshotFile out;
+    out.file = fopen(temporary.c_str(), "wb");
+    if (out.file == nullptr)
+    {
+        std::cerr << "writeSceneSnapshot() ERROR: can't create " << temporary << std::endl;
+        return false;
+    }
+    // the header is written again at the end, once the offsets are known
+    out.append(&header, sizeof(header));
+
+    std::vector<SnapshotBlob> meshBlobs;
+    std::vector<unsigned char> image;
+    for (const Mesh* mesh : record.meshes)
+    {
+        encodeMeshImage(*mesh->data, image);
+        SnapshotBlob blob{ out.append(image.data(), image.size()), image.size(), 0, 0 };
+        meshBlobs.push_back(blob);
+    }
+    std::vector<SnapshotBlob> textureBlobs;
+    std::vector<float> tiles;
+    for (const Texture* texture : textures)
+    {
+        tiles.resize(texture->getTileCount() * Texture::TileFloats);
+        texture->copyTiles(tiles.data());
+        size_t bytes = tiles.size() * sizeof(float);
+        SnapshotBlob blob{ out.append(tiles.data(), bytes), bytes, texture->getWidth(), texture->getHeight() };
+        textureBlobs.push_back(blob);
+    }
+
+    header.lightCount = (uint32_t)record.lights.size();
+    header.lightOffset = out.append(record.lights.data(), record.lights.size() * sizeof(SnapshotLight));
+    header.materialCount = (uint32_t)materials.size();
+    header.materialOffset = out.append(materials.data(), materials.size() * sizeof(SnapshotMaterial));
+    header.objectCount = (uint32_t)record.objects.size();
+    header.objectOffset = out.append(record.objects.data(), record.objects.size() * sizeof(SnapshotObject));
+    header.meshCount = (uint32_t)meshBlobs.size();
+    header.meshOffset = out.append(meshBlobs.data(), meshBlobs.size() * sizeof(SnapshotBlob));
+    header.textureCount = (uint32_t)textureBlobs.size();
+    header.textureOffset = out.append(textureBlobs.data(), textureBlobs.size() * sizeof(SnapshotBlob));
+
+    bool ok = out.ok && fseek(out.file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out.file) == 1;
+    ok = fclose(out.file) == 0 && ok;
+    // rename() won't replace an existing file everywhere
+    if (ok && std::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(filename.c_str());
+        ok = std::rename(temporary.c_str(), filename.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        std::cerr << "writeSceneSnapshot() ERROR: can't write " << filename << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    std::cout << filename << ": " << record.objects.size() << " objects, " << meshBlobs.size() << " meshes, "
+              << textureBlobs.size() << " textures, " << out.position / (1024.0 * 1024.0) << " MB" << std::endl;
+    return true;
+}
+
+bool loadSceneSnapshot(const std::string& filename, SceneParser& scene)
+{
+    // read-only and private: every process mapping the file shares the
+    // same page cache pages
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->open(filename, MappedFile::Random))
+    {
+        return false;
+    }
+    const size_t size = file->size();
+    const unsigned char* base = file->data();
+    SceneSnapshotHeader header;
+    if (size < sizeof(header))
+    {
+        std::cerr << filename << ": not a scene snapshot" << std::endl;
+        return false;
+    }
+    memcpy(&header, base, sizeof(header));
+    bool valid = memcmp(header.magic, "SRTSCENE", 8) == 0
+        && header.version == SnapshotVersion
+        && header.objectSize == sizeof(SnapshotObject)
+        && tableFits(header.lightOffset, header.lightCount, sizeof(SnapshotLight), size)
+        && tableFits(header.materialOffset, header.materialCount, sizeof(SnapshotMaterial), size)
+        && tableFits(header.objectOffset, header.objectCount, sizeof(SnapshotObject), size)
+        && tableFits(header.meshOffset, header.meshCount, sizeof(SnapshotBlob), size)
+        && tableFits(header.textureOffset, header.textureCount, sizeof(SnapshotBlob), size);
+    if (!valid)
+    {
+        std::cerr << filename << ": not a scene snapshot of this build" << std::endl;
+        return false;
+    }
+    const SnapshotLight* lights = (const SnapshotLight*)(base + header.lightOffset);
+    const SnapshotMaterial* materials = (const SnapshotMaterial*)(base + header.materialOffset);
+    const SnapshotObject* objects = (const SnapshotObject*)(base + header.objectOffset);
+    const SnapshotBlob* meshBlobs = (const SnapshotBlob*)(base + header.meshOffset);
+    const SnapshotBlob* textureBlobs = (const SnapshotBlob*)(base + header.textureOffset);
+
+    SceneRecord& record = scene.record;
+    record.camera = header.camera;
+    if (header.camera.valid)
+    {
+        const SnapshotCamera& c = header.camera;
+        scene.camera = scene.getArena().create<PerspectiveCamera>(fromFloats(c.center), fromFloats(c.direction), fromFloats(c.up),
+                                                             c.fovy, c.aspectRatio);
+    }
+    scene.background_color = fromFloats(header.background);
+    scene.ambient_light = fromFloats(header.ambient);
+
+    scene.num_lights = (int)header.lightCount;
+    scene.lights = scene.getArena().createArray<Light*>(header.lightCount);
+    for (uint32_t i = 0; i < header.lightCount; i++)
+    {
+        const SnapshotLight& l = lights[i];
+        if (l.type == SnapshotPointLight)
+        {
+            scene.lights[i] = scene.getArena().create<PointLight>(fromFloats(l.vector), fromFloats(l.color));
+        }
+        else
+        {
+            scene.lights[i] = scene.getArena().create<DirectionalLight>(fromFloats(l.vector), fromFloats(l.color));
+        }
+        record.lights.push_back(l);
+    }
+
+    std::vector<std::shared_ptr<Texture>> textures(header.textureCount);
+    for (uint32_t i = 0; i < header.textureCount; i++)
+    {
+        const SnapshotBlob& blob = textureBlobs[i];
+        textures[i] = std::make_shared<Texture>();
+        if (blob.offset % sizeof(float) != 0 || !tableFits(blob.offset, blob.size, 1, size) ||
+            !textures[i]->attach(file, (const float*)(base + blob.offset), blob.width, blob.height) ||
+            textures[i]->getTileCount() * Texture::TileFloats * sizeof(float) != blob.size)
+        {
+            std::cerr << filename << ": damaged texture " << i << std::endl;
+            return false;
+        }
+    }
+
+    scene.num_materials = (int)header.materialCount;
+    scene.materials = scene.getArena().createArray<Material*>(header.materialCount);
+    for (uint32_t i = 0; i < header.materialCount; i++)
+    {
+        const SnapshotMaterial& m = materials[i];
+        scene.materials[i] = scene.getArena().create<Material>(fromFloats(m.diffuse), fromFloats(m.specular), m.shininess);
+        scene.materials[i]->setId((int)i);
+        if (m.texture >= 0 && (uint32_t)m.texture < header.textureCount)
+        {
+            scene.materials[i]->setTexture(textures[m.texture]);
+        }
+    }
+
+    record.meshes.assign(header.meshCount, nullptr);
+    if (header.objectCount > 0)
+    {
+        size_t index = 0;
+        Object3D* root = buildObject(objects, header.objectCount, index, file, meshBlobs, header.meshCount,
+                                     scene, record.meshes);
+        if (root == nullptr || objects[0].type != SnapshotGroup || index != header.objectCount)
+        {
+            std::cerr << filename << ": damaged object tree" << std::endl;
+            return false;
+        }
+        scene.group = (Group*)root;
+        record.objects.assign(objects, objects + header.objectCount);
+    }
+    std::cout << filename << ": " << header.objectCount << " objects, " << header.meshCount << " meshes, "
+              << header.textureCount << " textures mapped" << std::endl;
+    return true;
+}
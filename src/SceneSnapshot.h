@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Mesh;
+class SceneParser;
+
+enum SnapshotObjectType
+{
+    SnapshotGroup,
+    SnapshotSphere,
+    SnapshotPlane,
+    SnapshotTriangle,
+    SnapshotMesh,
+    SnapshotTransform
+};
+
+enum SnapshotLightType
+{
+    SnapshotDirectionalLight,
+    SnapshotPointLight
+};
+
+// One object of the scene tree as the parser read it, in pre-order: a
+// group is followed by its children, a transform by its object.
+struct SnapshotObject
+{
+    uint32_t type;
+    int32_t material;   // index into the scene's materials, -1 for none
+    uint32_t children;  // subtrees that follow: the group size, 1 for a transform
+    int32_t mesh;       // index into SceneRecord::meshes, -1 for none
+    // sphere: center, radius; plane: normal, offset; triangle: the three
+    // vertices; transform: the matrix, column major
+    float params[16];
+};
+
+struct SnapshotLight
+{
+    uint32_t type;
+    float vector[3];    // direction or position
+    float color[3];
+};
+
+struct SnapshotCamera
+{
+    uint32_t valid;
+    float center[3];
+    float direction[3];
+    float up[3];
+    float fovy;         // radians
+    float aspectRatio;
+};
+
+// What SceneParser read, in the form a snapshot stores it. The built
+// objects don't all remember their parameters, so the parser records them
+// as it goes.
+struct SceneRecord
+{
+    SnapshotCamera camera{};
+    std::vector<SnapshotLight> lights;
+    std::vector<SnapshotObject> objects;
+    std::vector<Mesh*> meshes;         // one per distinct mesh data
+};
+
+// Writes the fully built scene into one file: camera, lights, materials,
+// the object tree, every mesh with its normals and BVH, and every texture
+// as its complete pyramid of decoded tiles.
+//
+// Everything in the file is addressed by offsets from its start, so it can
+// be mapped anywhere. A scene loaded from it maps the file read-only and
+// renders straight out of the mapping: render processes on one machine
+// that load the same snapshot share its physical pages through the page
+// cache instead of each holding a private copy of the geometry.
+bool writeSceneSnapshot(const SceneParser& scene, const std::string& filename);
+
+// rebuilds scene from a snapshot; large arrays stay in the mapping
+bool loadSceneSnapshot(const std::string& filename, SceneParser& scene);
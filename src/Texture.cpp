@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TEXTURE_USE_SSE
+#endif
+
+#include "Texture.h"
+
+// std::min takes these by reference
+const int Texture::TileSize;
+const size_t Texture::TileFloats;
+
+const float* Texture::srgbToLinearTable()
+{
+    static float table[256];
+    static bool initialized = [&]()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return true;
+    }();
+    (void)initialized;
+    return table;
+}
+
+static int roundUpToTiles(int n)
+{
+    return (n + Texture::TileSize - 1) / Texture::TileSize;
+}
+
+Texture::Texture()
+{
+}
+
+Texture::~Texture()
+{
+    if (residentTiles == nullptr)
+    {
+        TextureCache::instance().releaseTexture(id);
+    }
+}
+
+bool Texture::load(const char* filename)
+{
+    this->filename = filename;
+    // tiles are read in whatever order the renderer looks them up
+    if (!file.open(filename, MappedFile::Random) || !parseBMPHeader(file, filename, layout))
+    {
+        std::cerr << "Texture::load() ERROR: can't use " << filename << std::endl;
+        file.close();
+        return false;
+    }
+    width = layout.width;
+    height = layout.height;
+    buildLevels();
+    return true;
+}
+
+void Texture::buildLevels()
+{
+    levels.clear();
+    levelFirstTile.clear();
+    size_t tiles = 0;
+    Level level;
+    level.width = width;
+    level.height = height;
+    while (true)
+    {
+        level.tilesX = roundUpToTiles(level.width);
+        level.tilesY = roundUpToTiles(level.height);
+        levels.push_back(level);
+        levelFirstTile.push_back(tiles);
+        tiles += (size_t)level.tilesX * level.tilesY;
+        if (level.width == 1 && level.height == 1)
+        {
+            break;
+        }
+        level.width = std::max(1, level.width / 2);
+        level.height = std::max(1, level.height / 2);
+    }
+    levelFirstTile.push_back(tiles);
+}
+
+size_t Texture::getTileCount() const
+{
+    return levelFirstTile.empty() ? 0 : levelFirstTile.back();
+}
+
+void Texture::copyTiles(float* out) const
+{
+    for (int level = 0; level < (int)levels.size(); level++)
+    {
+        int count = levels[level].tilesX * levels[level].tilesY;
+        for (int tile = 0; tile < count; tile++)
+        {
+            float* dst = out + (levelFirstTile[level] + tile) * TileFloats;
+            if (residentTiles != nullptr)
+            {
+                memcpy(dst, residentTiles + (levelFirstTile[level] + tile) * TileFloats, TileFloats * sizeof(float));
+            }
+            else
+            {
+                TextureCache::TilePtr t = TextureCache::instance().getTile(*this, level, tile);
+                memcpy(dst, t.get(), TileFloats * sizeof(float));
+            }
+        }
+    }
+}
+
+bool Texture::attach(const std::shared_ptr<MappedFile>& file, const float* tiles, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+    {
+        return false;
+    }
+    this->width = width;
+    this->height = height;
+    buildLevels();
+    residentFile = file;
+    residentTiles = tiles;
+    return true;
+}
+
+void Texture::decodeTile(int level, int tile, float* out) const
+{
+    const Level& l = levels[level];
+    const int tx = tile % l.tilesX;
+    const int ty = tile / l.tilesX;
+    const int x0 = tx * TileSize;
+    const int y0 = ty * TileSize;
+    const int w = std::min(TileSize, l.width - x0);
+    const int h = std::min(TileSize, l.height - y0);
+
+    if (level == 0)
+    {
+        // no locking needed, every tile reads its own part of the mapping
+        const float* lut = srgbToLinearTable();
+        for (int y = 0; y < h; y++)
+        {
+            const unsigned char* row = layout.row(file, y0 + y) + (size_t)layout.channels * x0;
+            convertRowToRGBA(row, w, layout, lut, out + (size_t)y * TileSize * 4);
+        }
+        return;
+    }
+
+    // box filter the level above; the 2x2 source tiles are pinned locally
+    const Level& src = levels[level - 1];
+    TextureCache::TilePtr pinned[4];
+    int pinnedIds[4];
+    int numPinned = 0;
+    for (int y = 0; y < h; y++)
+    {
+        int sy0 = std::min(2 * (y0 + y), src.height - 1);
+        int sy1 = std::min(2 * (y0 + y) + 1, src.height - 1);
+        for (int x = 0; x < w; x++)
+        {
+            int sx0 = std::min(2 * (x0 + x), src.width - 1);
+            int sx1 = std::min(2 * (x0 + x) + 1, src.width - 1);
+            const float* a = texel(level - 1, sx0, sy0, pinned, pinnedIds, numPinned);
+            const float* b = texel(level - 1, sx1, sy0, pinned, pinnedIds, numPinned);
+            const float* c = texel(level - 1, sx0, sy1, pinned, pinnedIds, numPinned);
+            const float* d = texel(level - 1, sx1, sy1, pinned, pinnedIds, numPinned);
+            float* t = out + ((size_t)y * TileSize + x) * 4;
+            for (int i = 0; i < 3; i++)
+            {
+                t[i] = 0.25f * (a[i] + b[i] + c[i] + d[i]);
+            }
+        }
+    }
+}
+
+// texel (x, y) of a level; the tiles it comes from are kept in pinned so
+// they stay alive, and so neighbouring lookups can skip the cache
+const float* Texture::texel(int level, int x, int y, TextureCache::TilePtr* pinned, int* pinnedIds, int& numPinned) const
+{
+    const Level& l = levels[level];
+    int tile = (y / TileSize) * l.tilesX + (x / TileSize);
+    int inTile = (y % TileSize) * TileSize + (x % TileSize);
+    if (residentTiles != nullptr)
+    {
+        return residentTiles + (levelFirstTile[level] + tile) * TileFloats + (size_t)inTile * 4;
+    }
+    int slot = 0;
+    while (slot < numPinned && pinnedIds[slot] != tile)
+    {
+        slot++;
+    }
+    if (slot == numPinned)
+    {
+        if (numPinned == 4)
+        {
+            slot = 0;
+        }
+        else
+        {
+            numPinned++;
+        }
+        pinned[slot] = TextureCache::instance().getTile(*this, level, tile);
+        pinnedIds[slot] = tile;
+    }
+    return pinned[slot].get() + (size_t)inTile * 4;
+}
+
+glm::vec3 Texture::bilinear(int level, float x, float y) const
+{
+    const Level& l = levels[level];
+    int ix = (int)floorf(x);
+    int iy = (int)floorf(y);
+    float alpha = x - ix;
+    float beta = y - iy;
+    int x0 = std::min(std::max(ix, 0), l.width - 1);
+    int x1 = std::min(std::max(ix + 1, 0), l.width - 1);
+    int y0 = std::min(std::max(iy, 0), l.height - 1);
+    int y1 = std::min(std::max(iy + 1, 0), l.height - 1);
+
+    TextureCache::TilePtr pinned[4];
+    int pinnedIds[4];
+    int numPinned = 0;
+    const float* p00 = texel(level, x0, y0, pinned, pinnedIds, numPinned);
+    const float* p10 = texel(level, x1, y0, pinned, pinnedIds, numPinned);
+    const float* p01 = texel(level, x0, y1, pinned, pinnedIds, numPinned);
+    const float* p11 = texel(level, x1, y1, pinned, pinnedIds, numPinned);
+
+#ifdef TEXTURE_USE_SSE
+    __m128 c00 = _mm_loadu_ps(p00);
+    __m128 c10 = _mm_loadu_ps(p10);
+    __m128 c01 = _mm_loadu_ps(p01);
+    __m128 c11 = _mm_loadu_ps(p11);
+    __m128 a = _mm_set1_ps(alpha);
+    __m128 b = _mm_set1_ps(beta);
+    // lerp in x on both rows, then in y
+    __m128 top = _mm_add_ps(c00, _mm_mul_ps(a, _mm_sub_ps(c10, c00)));
+    __m128 bottom = _mm_add_ps(c01, _mm_mul_ps(a, _mm_sub_ps(c11, c01)));
+    __m128 result = _mm_add_ps(top, _mm_mul_ps(b, _mm_sub_ps(bottom, top)));
+    float out[4];
+    _mm_storeu_ps(out, result);
+    return glm::vec3(out[0], out[1], out[2]);
+#else
+    glm::vec3 color;
+    for (int i = 0; i < 3; i++)
+    {
+        float top = p00[i] + alpha * (p10[i] - p00[i]);
+        float bottom = p01[i] + alpha * (p11[i] - p01[i]);
+        color[i] = top + beta * (bottom - top);
+    }
+    return color;
+#endif
+}
+
+glm::vec3 Texture::sample(float u, float v, float footprint) const
+{
+    float lod = 0.0f;
+    if (footprint > 0.0f)
+    {
+        lod = log2f(footprint * std::max(width, height));
+        lod = std::min(std::max(lod, 0.0f), (float)(levels.size() - 1));
+    }
+    int level = (int)lod;
+    float t = lod - level;
+
+    // level sizes are rounded down, so scale by each level's own size
+    const Level& l0 = levels[level];
+    glm::vec3 color = bilinear(level, u * l0.width, (1 - v) * l0.height);
+    if (t > 0.0f && level + 1 < (int)levels.size())
+    {
+        const Level& l1 = levels[level + 1];
+        glm::vec3 coarse = bilinear(level + 1, u * l1.width, (1 - v) * l1.height);
+        color = color + (coarse - color) * t;
+    }
+    return color;
+}
@@ -1,58 +1,100 @@
 #pragma once
 
+#include <memory>
+#include <string>
+#include <vector>
 #include <glm/glm.hpp>
-#include "bitmap_image.h"
 
+#include "ImageFormats.h"
+#include "MappedFile.h"
+#include "TextureCache.h"
+
+// Texture kept as a mip pyramid of linear float texels.
+//
+// Each level is split into TileSize x TileSize tiles of RGBA floats (alpha
+// is padding so a texel is one SSE register). Tiles are the unit the
+// TextureCache loads and evicts: level 0 tiles are decoded straight from
+// the rows of the mapped file they cover, lower levels are 2x2 box filtered from
+// the tiles above them, and nothing is decoded before it is looked up.
+// Textures restored from a scene snapshot skip all of that and read their
+// tiles straight out of the snapshot's mapping.
+// Texel (0, 0) is the top left corner of the file, v = 1 maps to the top row.
+//
+// Textures are shared, get them through TextureCache::getTexture.
 class Texture
 {
-	bitmap_image* bimg{nullptr};
-	int width{0};
-	int height{0};
 public:
-    Texture() {}
-    ~Texture() { delete bimg;  }
+    static const int TileSize = 32;
+    static const size_t TileFloats = TileSize * TileSize * 4;
 
-    void operator()(int x, int y, unsigned char* color)
+private:
+    struct Level
     {
-        x = clamp(x, 0, width - 1);
-        y = clamp(y, 0, height - 1);
-        bimg->get_pixel(x, y, color[0], color[1], color[2]);
-    }
+        int width{ 0 };
+        int height{ 0 };
+        int tilesX{ 0 };
+        int tilesY{ 0 };
+    };
 
-    bool Texture::valid()
-    {
-        return (bimg != nullptr);
-    }
-    
-    glm::vec3 operator()(float x, float y)
+    std::vector<Level> levels;
+    std::string filename;
+    uint32_t id{ 0 };
+    int width{ 0 };
+    int height{ 0 };
+
+    // mapped BMP the level 0 tiles are converted from
+    MappedFile file;
+    PixelLayout layout;
+
+    // or every tile of every level, already decoded (from a scene snapshot)
+    std::shared_ptr<MappedFile> residentFile;
+    const float* residentTiles{ nullptr };
+    std::vector<size_t> levelFirstTile;
+
+    friend class TextureCache;
+    void buildLevels();
+    void decodeTile(int level, int tile, float* out) const;
+
+    const float* texel(int level, int x, int y, TextureCache::TilePtr* pinned, int* pinnedIds, int& numPinned) const;
+    glm::vec3 bilinear(int level, float x, float y) const;
+
+public:
+    Texture();
+    ~Texture();
+    Texture(const Texture&) = delete;
+    Texture& operator=(const Texture&) = delete;
+
+    bool valid() const
     {
-        glm::vec3 color;
-        int ix, iy;
-        x = x * width;
-        y = (1 - y) * height;
-        ix = (int)x;
-        iy = (int)y;
-        unsigned char pixels[4][3];
-        float alpha = x - ix;
-        float beta = y - iy;
-        operator()(ix, iy, pixels[0]);
-        operator()(ix + 1, iy, pixels[1]);
-        operator()(ix, iy + 1, pixels[2]);
-        operator()(ix + 1, iy + 1, pixels[3]);
-        for (int ii = 0; ii < 3; ii++) {
-            color[ii] = (1 - alpha) * (1 - beta) * pixels[0][ii]
-                + alpha * (1 - beta) * pixels[1][ii]
-                + (1 - alpha) * beta * pixels[2][ii]
-                + alpha * beta * pixels[3][ii];
-        }
-        return color / 255.0f;
+        return !levels.empty();
     }
 
-    void Texture::load(const char* filename)
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getNumLevels() const { return (int)levels.size(); }
+    uint32_t getId() const { return id; }
+
+    // maps the file and validates its header; tiles are decoded on demand
+    bool load(const char* filename);
+
+    // tiles of all levels, finest first, in the layout of copyTiles()
+    size_t getTileCount() const;
+    // decodes every tile into out (getTileCount() * TileFloats floats)
+    void copyTiles(float* out) const;
+    // uses tiles written by copyTiles() in place; they live in file, which
+    // the texture keeps mapped. Such textures bypass the TextureCache.
+    bool attach(const std::shared_ptr<MappedFile>& file, const float* tiles, int width, int height);
+
+    // bilinear lookup in the full resolution level
+    glm::vec3 operator()(float x, float y) const
     {
-        bimg = new bitmap_image(filename);
-        height = bimg->height();
-        width = bimg->width();
+        return bilinear(0, x * width, (1 - y) * height);
     }
-};
 
+    // trilinear lookup; footprint is the width of the ray footprint in uv
+    // units, 0 falls back to the full resolution level
+    glm::vec3 sample(float u, float v, float footprint) const;
+
+    // 8 bit sRGB to linear float, exact for every byte value
+    static const float* srgbToLinearTable();
+};
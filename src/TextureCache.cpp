@@ -0,0 +1,129 @@
+#include <filesystem>
+
+#include "TextureCache.h"
+#include "AllocationCounter.h"
+#include "Texture.h"
+
+TextureCache& TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    budget = bytes;
+    trim();
+}
+
+std::shared_ptr<Texture> TextureCache::getTexture(const std::string& filename)
+{
+    // the same file reached through different relative paths is one texture
+    std::error_code ec;
+    std::string path = std::filesystem::weakly_canonical(filename, ec).string();
+    if (ec)
+    {
+        path = filename;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<Texture> texture = textures[path].lock();
+    if (!texture)
+    {
+        // only the header is read here, so holding the lock is cheap
+        texture = std::make_shared<Texture>();
+        texture->id = nextTextureId++;
+        texture->load(filename.c_str());
+        textures[path] = texture;
+    }
+    return texture;
+}
+
+TextureCache::TilePtr TextureCache::getTile(const Texture& texture, int level, int tileIndex)
+{
+    const uint64_t k = key(texture.getId(), level, tileIndex);
+    Shard& shard = shardFor(k);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.tiles.find(k);
+        if (it != shard.tiles.end())
+        {
+            it->second.recent = true;
+            return it->second.tile;
+        }
+    }
+
+    // a miss allocates by design, even inside the render loop
+    AllocationCounter::Allow allow;
+    // decode without holding the lock; lower mip levels come back in here
+    // for the tiles they are filtered from
+    TilePtr tile(new float[Texture::TileFloats](), std::default_delete<float[]>());
+    texture.decodeTile(level, tileIndex, const_cast<float*>(tile.get()));
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.tiles.find(k);
+        if (it != shard.tiles.end())
+        {
+            // another thread decoded it in the meantime
+            it->second.recent = true;
+            return it->second.tile;
+        }
+        Entry entry;
+        entry.tile = tile;
+        entry.bytes = Texture::TileFloats * sizeof(float);
+        entry.recent = true;
+        shard.tiles[k] = entry;
+        used += entry.bytes;
+    }
+    if (used > budget)
+    {
+        trim();
+    }
+    return tile;
+}
+
+void TextureCache::releaseTexture(uint32_t texture)
+{
+    for (Shard& shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.tiles.begin(); it != shard.tiles.end();)
+        {
+            if ((uint32_t)(it->first >> 32) == texture)
+            {
+                used -= it->second.bytes;
+                it = shard.tiles.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
+void TextureCache::trim()
+{
+    std::lock_guard<std::mutex> trimLock(trimMutex);
+    // the first lap clears every mark, so two laps evict anything needed
+    for (int visited = 0; visited < 2 * ShardCount && used > budget; visited++)
+    {
+        Shard& shard = shards[trimHand];
+        trimHand = (trimHand + 1) % ShardCount;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.tiles.begin(); it != shard.tiles.end() && used > budget;)
+        {
+            if (it->second.recent)
+            {
+                it->second.recent = false;
+                ++it;
+            }
+            else
+            {
+                used -= it->second.bytes;
+                it = shard.tiles.erase(it);
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Texture;
+
+// Process-wide cache that shares textures between materials and keeps their
+// decoded tiles under a memory budget.
+//
+// getTexture() hands out one Texture per canonical path, so twenty
+// materials that name the same file share one copy. Textures only read
+// their file header up front; tiles are decoded on first access and kept in
+// a map split into shards with a lock each, so lookups from different
+// threads rarely meet. A hit only marks its tile as recently used; when a
+// new tile pushes the cache over budget, trim() sweeps the shards like a
+// clock, evicting unmarked tiles and clearing the mark on the others. Tiles
+// still referenced by a lookup in progress stay alive until it is done, so
+// eviction never invalidates memory under a reader.
+class TextureCache
+{
+public:
+    typedef std::shared_ptr<const float> TilePtr;
+
+private:
+    struct Entry
+    {
+        TilePtr tile;
+        size_t bytes;
+        bool recent;
+    };
+
+    // a power of two, well above the thread counts renders run with
+    static const int ShardCount = 64;
+
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Entry> tiles;
+    };
+
+    mutable std::mutex mutex;           // guards textures and nextTextureId
+    std::unordered_map<std::string, std::weak_ptr<Texture>> textures;
+    uint32_t nextTextureId{ 0 };
+
+    Shard shards[ShardCount];
+    std::atomic<size_t> budget{ 512u << 20 };
+    std::atomic<size_t> used{ 0 };
+    std::mutex trimMutex;               // one sweep at a time
+    int trimHand{ 0 };                  // next shard to sweep
+
+    static uint64_t key(uint32_t texture, int level, int tile)
+    {
+        return ((uint64_t)texture << 32) | ((uint64_t)level << 24) | (uint64_t)tile;
+    }
+
+    Shard& shardFor(uint64_t k)
+    {
+        // neighbouring tiles of one texture land in different shards
+        return shards[(k * 0x9E3779B97F4A7C15ull) >> 58];
+    }
+
+    void trim();
+
+    TextureCache() {}
+public:
+    static TextureCache& instance();
+
+    void setBudget(size_t bytes);
+    size_t getBudget() const { return budget; }
+    size_t getUsed() const { return used; }
+
+    // returns the shared texture for filename, loading its header if this
+    // is the first reference; an invalid texture if the file is unusable
+    std::shared_ptr<Texture> getTexture(const std::string& filename);
+
+    // returns the requested tile, decoding it through the texture if needed
+    TilePtr getTile(const Texture& texture, int level, int tileIndex);
+
+    // drops every cached tile of a texture that is going away
+    void releaseTexture(uint32_t texture);
+};
@@ -0,0 +1,47 @@
+#include "ThreadPool.h"
+#include "Parallel.h"
+
+ThreadPool::ThreadPool(int numThreads)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = defaultThreadCount();
+    }
+    workers.reserve(numThreads);
+    for (int i = 0; i < numThreads; i++)
+    {
+        workers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]() { return !tasks.empty() || quit; });
+        if (tasks.empty())
+        {
+            break;
+        }
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running submitted tasks in FIFO order.
+// submit() returns a future for the task's result; the destructor finishes
+// every queued task before joining the workers.
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit{ false };
+
+    void run();
+public:
+    ThreadPool() = delete;
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // numThreads <= 0 uses one thread per core
+    ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    int getThreadCount() const
+    {
+        return (int)workers.size();
+    }
+
+    template <typename Fn>
+    std::future<decltype(std::declval<Fn&>()())> submit(Fn fn)
+    {
+        typedef decltype(fn()) Result;
+        // std::function needs something copyable
+        std::shared_ptr<std::packaged_task<Result()>> task =
+            std::make_shared<std::packaged_task<Result()>>(std::move(fn));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back([task]() { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <new>
 
 #include "Object3D.h"
 
@@ -27,4 +29,26 @@ public:
 
 		return obj->intersect(Ray(orig3, dir3), hit, tmin);
 	}
+
+	virtual void intersectBatch(const Ray* rays, Hit* hits, bool* results, int count, float tmin)
+	{
+		// the same mapping as intersect(), with the inverse computed once; the
+		// mapped rays live on the stack, a chunk at a time, so nested
+		// transforms don't allocate
+		const int Chunk = 512;
+		alignas(Ray) unsigned char storage[Chunk * sizeof(Ray)];
+		Ray* local = reinterpret_cast<Ray*>(storage);
+		glm::mat4 inverse = glm::inverse(transMat);
+		for (int first = 0; first < count; first += Chunk)
+		{
+			int n = std::min(Chunk, count - first);
+			for (int i = 0; i < n; i++)
+			{
+				glm::vec4 dir4 = inverse * glm::vec4(rays[first + i].getDirection(), 1.0f);
+				glm::vec4 orig4 = inverse * glm::vec4(rays[first + i].getOrigin(), 1.0f);
+				new (local + i) Ray(glm::vec3(orig4) / orig4.w, glm::vec3(dir4) / dir4.w);
+			}
+			obj->intersectBatch(local, hits + first, results + first, n, tmin);
+		}
+	}
 };
\ No newline at end of file
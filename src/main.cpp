@@ -1,12 +1,77 @@
+#include <algorithm>
+#include <csignal>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "SceneParser.h"
 #include "Image.h"
 #include "Camera.h"
+#include "Framebuffer.h"
+#include "Renderer.h"
+#include "Checkpoint.h"
+#include "Denoiser.h"
+#include "TextureCache.h"
+#include "ImageStream.h"
+#include "FrameEncoder.h"
+#include "ImageCompare.h"
+#include "MeshCache.h"
+#include "GeometryStreamer.h"
 
 #include "bitmap_image.h"
 
+static Renderer* activeRenderer = nullptr;
+static volatile std::sig_atomic_t interrupted = 0;
+
+// ctrl-c (or a pre-empting scheduler's SIGTERM) stops the render after the
+// tiles in flight
+static void onInterrupt(int)
+{
+    interrupted = 1;
+    if (activeRenderer != nullptr)
+    {
+        activeRenderer->cancel();
+    }
+}
+
+// "out%04d.tga" style patterns are filled in, otherwise the frame number
+// goes in front of the extension
+static std::string frameFilename(const std::string& pattern, int frame)
+{
+    char name[1024];
+    if (pattern.find('%') != std::string::npos)
+    {
+        snprintf(name, sizeof(name), pattern.c_str(), frame);
+        return name;
+    }
+    size_t dot = pattern.rfind('.');
+    snprintf(name, sizeof(name), "_%04d", frame);
+    return dot == std::string::npos ? pattern + name : pattern.substr(0, dot) + name + pattern.substr(dot);
+}
+
+static void printError(const std::string& against, const ImageError& error)
+{
+    std::cout << "vs " << against << ": mse " << error.mse << ", psnr " << error.psnr << " dB, ssim " << error.ssim
+              << ", max error " << error.maxError << ", " << error.failedPixels << " pixels over tolerance" << std::endl;
+}
+
+static void printStats(const RenderStats& stats)
+{
+    std::cout << stats.passes << " passes, " << stats.samples << " samples"
+              << (stats.converged ? " (converged)" : "")
+              << (stats.timedOut ? " (out of time)" : "")
+              << (stats.cancelled ? " (cancelled)" : "") << std::endl;
+    GeometryStreamer& streamer = GeometryStreamer::instance();
+    if (streamer.isEnabled())
+    {
+        std::cout << "geometry: " << streamer.getLoads() << " loads, " << streamer.getEvictions() << " evictions, "
+                  << streamer.getUsed() / (1024.0 * 1024.0) << " MB resident" << std::endl;
+    }
+}
+
 int main(int argc, char** argv)
 {
     // Fill in your implementation here.
@@ -15,7 +80,35 @@ int main(int argc, char** argv)
     int width, height;
     std::string outputFilename;
     std::string depthFilename;
-    int minDepth, maxDepth;
+    float minDepth = 0.0f, maxDepth = 1.0f;
+    std::string normalsFilename;
+    std::string albedoFilename;
+    std::string materialIdFilename;
+    std::string hitCountFilename;
+    bool denoiseOutput = false;
+    DenoiseSettings denoiseSettings;
+    QuantizeSettings outputSettings;
+    bool streamOutput = false;
+    bool halfOutput = false;
+    int frames = 1;
+    std::string referenceFilename;
+    std::string diffFilename;
+    std::string maskFilename;
+    std::string compareFilename;
+    std::vector<std::string> convertMeshFilenames;
+    std::vector<std::string> verifyMeshFilenames;
+    std::string snapshotFilename;
+    CompareSettings compareSettings;
+    long long maxFailedPixels = 0;
+    double minPsnr = 0.0;
+    double minSsim = -1.0;
+    std::string sampleCountFilename;
+    std::string checkpointFilename;
+    std::string resumeFilename;
+    std::string framebufferFilename;
+    int checkpointInterval = 300;
+    size_t geometryBudget = 0;
+    RenderSettings settings;
 
     // This loop loops over each of the input arguments.
     // argNum is initialized to 1 because the first
@@ -55,50 +148,617 @@ int main(int argc, char** argv)
         if ((std::string(argv[argNum]) == "-depth") && argc > argNum + 3)
         {
             std::cout << argv[argNum] << ":  " << "came for min and max depth" << std::endl;
-            minDepth = std::stoi(std::string(argv[argNum + 1]));
-            maxDepth = std::stoi(std::string(argv[argNum + 2]));
+            minDepth = std::stof(std::string(argv[argNum + 1]));
+            maxDepth = std::stof(std::string(argv[argNum + 2]));
             depthFilename = std::string(argv[argNum + 3]);
             std::cout << depthFilename << std::endl;
             std::cout << minDepth << " and " << maxDepth << std::endl;
             argNum += 4;
             continue;
         }
+        if ((std::string(argv[argNum]) == "-spp") && argc > argNum + 1)
+        {
+            settings.baseSamples = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-max-spp") && argc > argNum + 1)
+        {
+            settings.maxSamples = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-threshold") && argc > argNum + 1)
+        {
+            settings.errorThreshold = std::stof(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-sample-count") && argc > argNum + 1)
+        {
+            sampleCountFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-threads") && argc > argNum + 1)
+        {
+            settings.threads = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-tile") && argc > argNum + 1)
+        {
+            settings.tileSize = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-sampler") && argc > argNum + 1)
+        {
+            if (!Sampler::parseType(std::string(argv[argNum + 1]), settings.sampler))
+            {
+                std::cout << "unknown sampler " << argv[argNum + 1] << std::endl;
+            }
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-seed") && argc > argNum + 1)
+        {
+            settings.seed = (uint32_t)std::stoul(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if (std::string(argv[argNum]) == "-progressive")
+        {
+            settings.progressive = true;
+            argNum += 1;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-time-budget") && argc > argNum + 1)
+        {
+            settings.timeBudget = std::stoll(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-checkpoint") && argc > argNum + 1)
+        {
+            checkpointFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-checkpoint-interval") && argc > argNum + 1)
+        {
+            checkpointInterval = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-resume") && argc > argNum + 1)
+        {
+            resumeFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-framebuffer-file") && argc > argNum + 1)
+        {
+            framebufferFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-normals") && argc > argNum + 1)
+        {
+            normalsFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-albedo") && argc > argNum + 1)
+        {
+            albedoFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-material-id") && argc > argNum + 1)
+        {
+            materialIdFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-hit-count") && argc > argNum + 1)
+        {
+            hitCountFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if (std::string(argv[argNum]) == "-denoise")
+        {
+            denoiseOutput = true;
+            argNum += 1;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-denoise-iterations") && argc > argNum + 1)
+        {
+            denoiseSettings.iterations = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-reference") && argc > argNum + 1)
+        {
+            referenceFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-diff") && argc > argNum + 1)
+        {
+            diffFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-mask") && argc > argNum + 1)
+        {
+            maskFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-convert-mesh") && argc > argNum + 1)
+        {
+            // no rendering, just writes the mesh cache of an OBJ
+            convertMeshFilenames.push_back(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-verify-mesh") && argc > argNum + 1)
+        {
+            // no rendering, just checks the mesh cache of an OBJ
+            verifyMeshFilenames.push_back(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-write-snapshot") && argc > argNum + 1)
+        {
+            // no rendering, just writes the built scene for -input to map
+            snapshotFilename = std::string(argv[argNum + 1]);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-compare") && argc > argNum + 2)
+        {
+            // no rendering, just checks an image against a golden one
+            compareFilename = std::string(argv[argNum + 1]);
+            referenceFilename = std::string(argv[argNum + 2]);
+            argNum += 3;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-tolerance") && argc > argNum + 1)
+        {
+            compareSettings.tolerance = std::stof(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-max-failed") && argc > argNum + 1)
+        {
+            maxFailedPixels = std::stoll(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-min-psnr") && argc > argNum + 1)
+        {
+            minPsnr = std::stod(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-min-ssim") && argc > argNum + 1)
+        {
+            minSsim = std::stod(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-gamma") && argc > argNum + 1)
+        {
+            outputSettings.gamma = std::stof(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if (std::string(argv[argNum]) == "-dither")
+        {
+            outputSettings.dither = true;
+            argNum += 1;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-frames") && argc > argNum + 1)
+        {
+            frames = std::stoi(std::string(argv[argNum + 1]));
+            argNum += 2;
+            continue;
+        }
+        if (std::string(argv[argNum]) == "-half")
+        {
+            // keep the resolved image as half floats, e.g. for a big .exr
+            halfOutput = true;
+            argNum += 1;
+            continue;
+        }
+        if (std::string(argv[argNum]) == "-stream")
+        {
+            streamOutput = true;
+            argNum += 1;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-texture-budget") && argc > argNum + 1)
+        {
+            // in megabytes
+            TextureCache::instance().setBudget((size_t)std::stoul(std::string(argv[argNum + 1])) << 20);
+            argNum += 2;
+            continue;
+        }
+        if ((std::string(argv[argNum]) == "-geometry-budget") && argc > argNum + 1)
+        {
+            // in megabytes; meshes with a mesh cache then load on first hit
+            geometryBudget = (size_t)std::stoul(std::string(argv[argNum + 1])) << 20;
+            argNum += 2;
+            continue;
+        }
         std::cout << "hmm... should not come here" << std::endl;
         argNum += 1;
     }
 
+    if (!convertMeshFilenames.empty())
+    {
+        bool ok = true;
+        for (const std::string& filename : convertMeshFilenames)
+        {
+            ok = convertMesh(filename) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (!verifyMeshFilenames.empty())
+    {
+        bool ok = true;
+        for (const std::string& filename : verifyMeshFilenames)
+        {
+            ok = verifyMeshCache(filename) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    compareSettings.threads = settings.threads;
+    if (!compareFilename.empty())
+    {
+        // exit code 0 if the image matches the golden one, 1 if it doesn't
+        // and 2 if they can't be compared at all
+        std::unique_ptr<Image> test(Image::Load(compareFilename));
+        std::unique_ptr<Image> golden(Image::Load(referenceFilename));
+        if (!test || !golden || test->Width() != golden->Width() || test->Height() != golden->Height())
+        {
+            std::cout << "can't compare " << compareFilename << " against " << referenceFilename << std::endl;
+            return 2;
+        }
+        std::unique_ptr<Image> diff(diffFilename.empty() ? nullptr : new Image(test->Width(), test->Height()));
+        std::unique_ptr<Image> mask(maskFilename.empty() ? nullptr : new Image(test->Width(), test->Height()));
+        ImageError error = compareImages(*test, *golden, compareSettings, diff.get(), mask.get());
+        printError(referenceFilename, error);
+        if (diff)
+        {
+            diff->SaveImage(diffFilename);
+        }
+        if (mask)
+        {
+            mask->SaveImage(maskFilename);
+        }
+        bool pass = error.failedPixels <= maxFailedPixels && error.psnr >= minPsnr && error.ssim >= minSsim;
+        std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+        return pass ? 0 : 1;
+    }
+
     // First, parse the scene using SceneParser.
     // Then loop over each pixel in the image, shooting a ray
     // through that pixel and finding its intersection with
     // the scene.  Write the color at the intersection to that
     // pixel in your output image.
+    if (geometryBudget > 0 && snapshotFilename.empty())
+    {
+        // a snapshot needs every mesh loaded
+        GeometryStreamer::instance().setBudget(geometryBudget);
+    }
     SceneParser sp = SceneParser(sceneFilename);
-    Image image(width, height);
 
-    glm::vec3 fgColor(0.8, 0.2, 0.0);
-    glm::vec3 bgColor(0.0f, 0.2f, 0.4f);
+    if (!snapshotFilename.empty())
+    {
+        return writeSceneSnapshot(sp, snapshotFilename) ? 0 : 1;
+    }
+
+    if (settings.progressive && settings.maxSamples <= settings.baseSamples)
+    {
+        // no explicit cap, keep refining until the budget or ctrl-c stops us
+        settings.maxSamples = 1 << 20;
+    }
+
+    if (streamOutput)
+    {
+        // the image goes to disk one band of tile rows at a time, so nothing
+        // that needs the whole frame is available
+        if (!resumeFilename.empty() || !checkpointFilename.empty() || denoiseOutput || !referenceFilename.empty() ||
+            !sampleCountFilename.empty() || !depthFilename.empty() || !normalsFilename.empty() ||
+            !albedoFilename.empty() || !materialIdFilename.empty() || !hitCountFilename.empty())
+        {
+            std::cout << "WARNING: -stream only writes the image; resume, checkpoints, AOVs, denoising, "
+                      << "sample counts and comparisons are skipped" << std::endl;
+        }
+        ImageStreamWriter writer(outputFilename, width, height, outputSettings);
+        if (!writer.valid())
+        {
+            return 1;
+        }
+        Renderer renderer(sp, settings);
+        activeRenderer = &renderer;
+        std::signal(SIGINT, onInterrupt);
+        std::signal(SIGTERM, onInterrupt);
+
+        RenderStats stats = renderer.renderBands(width, height, settings.tileSize, [&](const Framebuffer& band, int)
+        {
+            Image bandImage(band.Width(), band.Height());
+            band.Resolve(bandImage);
+            writer.writeBand(bandImage);
+        });
+
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        activeRenderer = nullptr;
+        printStats(stats);
+        return writer.close() ? 0 : 1;
+    }
+
+    if (frames > 1)
+    {
+        // a sequence of frames, each with its own sampler seed; frame N is
+        // encoded and written in the background while frame N + 1 renders
+        if (!resumeFilename.empty() || !checkpointFilename.empty() || !referenceFilename.empty() ||
+            !sampleCountFilename.empty() || !depthFilename.empty() || !normalsFilename.empty() ||
+            !albedoFilename.empty() || !materialIdFilename.empty() || !hitCountFilename.empty())
+        {
+            std::cout << "WARNING: -frames only writes the images; resume, checkpoints, AOVs, "
+                      << "sample counts and comparisons are skipped" << std::endl;
+        }
+        denoiseSettings.threads = settings.threads;
+        FrameEncoder encoder(2);
+        // the renderer, its threads and the framebuffers are set up once;
+        // frames take turns with the two framebuffers
+        Renderer renderer(sp, settings);
+        Framebuffer framebuffers[2] = { Framebuffer(width, height), Framebuffer(width, height) };
+        for (Framebuffer& fb : framebuffers)
+        {
+            if (denoiseOutput)
+            {
+                fb.EnableAov(AovNormal);
+                fb.EnableAov(AovDepth);
+                fb.EnableAov(AovAlbedo);
+            }
+        }
+        activeRenderer = &renderer;
+        std::signal(SIGINT, onInterrupt);
+        std::signal(SIGTERM, onInterrupt);
+        for (int frame = 0; frame < frames && !interrupted; frame++)
+        {
+            Framebuffer& fb = framebuffers[frame % 2];
+            if (frame >= 2)
+            {
+                fb.Clear();
+            }
+            renderer.setSeed(settings.seed + frame);
+            RenderStats stats = renderer.render(fb);
 
-    image.SetAllPixels(bgColor);
+            // blocks only when both buffers are still waiting for the disk
+            Image* frameImage = encoder.acquire(width, height, halfOutput);
+            if (denoiseOutput)
+            {
+                denoise(fb, *frameImage, denoiseSettings);
+            }
+            else
+            {
+                fb.Resolve(*frameImage);
+            }
+            std::string name = frameFilename(outputFilename, frame);
+            encoder.submit(frameImage, name, outputSettings);
+            std::cout << name << ": ";
+            printStats(stats);
+        }
+        encoder.flush();
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        activeRenderer = nullptr;
+        return 0;
+    }
 
-    for (int r = 0; r < width; r++)
+    std::unique_ptr<Framebuffer> framebuffer;
+    int firstPass = 0;
+    if (!resumeFilename.empty())
     {
-        for (int c = 0; c < height; c++)
+        CheckpointInfo info;
+        framebuffer.reset(loadCheckpoint(resumeFilename, info));
+        if (!framebuffer)
+        {
+            return 1;
+        }
+        // whatever decides the result has to come from the checkpoint
+        info.toSettings(settings);
+        width = info.width;
+        height = info.height;
+        firstPass = info.passes;
+        std::cout << "resuming " << width << "x" << height << " after " << firstPass << " passes" << std::endl;
+        if (checkpointFilename.empty())
+        {
+            checkpointFilename = resumeFilename;
+        }
+        if (!framebufferFilename.empty())
         {
-            // first let us generate the ray
-            float i = (height / 2.0 - c) / (height / 2.0);
-            float j = (r - width / 2.0) / (width / 2.0);
-            Ray ray = (sp.getCamera())->generateRay(glm::vec2(j, i));
+            std::unique_ptr<Framebuffer> mapped(new Framebuffer(width, height, framebufferFilename));
+            mapped->CopyFrom(*framebuffer);
+            framebuffer = std::move(mapped);
+        }
+    }
+    else if (!framebufferFilename.empty())
+    {
+        framebuffer.reset(new Framebuffer(width, height, framebufferFilename));
+    }
+    else
+    {
+        framebuffer.reset(new Framebuffer(width, height));
+    }
+    Image image(width, height, halfOutput);
 
-            // now let us get the intersection for this ray
-            Hit hit;
-            bool intersectionFound = sp.getGroup()->intersect(ray, hit, sp.getCamera()->getTMin());
-            if (intersectionFound)
+    // AOVs are accumulated from the beauty pass's own primary rays
+    struct AovOutput
+    {
+        AovType type;
+        const std::string& filename;
+    };
+    const AovOutput aovOutputs[] = {
+        { AovDepth, depthFilename },
+        { AovNormal, normalsFilename },
+        { AovAlbedo, albedoFilename },
+        { AovMaterialId, materialIdFilename },
+        { AovHitCount, hitCountFilename },
+    };
+    for (const AovOutput& aov : aovOutputs)
+    {
+        if (!aov.filename.empty() && !framebuffer->HasAov(aov.type))
+        {
+            if (firstPass > 0)
             {
-                image.SetPixel(r, c, fgColor);
+                std::cout << "WARNING: " << aov.filename << " was not in the checkpoint and only covers the resumed passes" << std::endl;
             }
+            framebuffer->EnableAov(aov.type);
         }
     }
-    image.SaveImage(outputFilename);
+
+    if (denoiseOutput)
+    {
+        // the denoiser's guide buffers
+        framebuffer->EnableAov(AovNormal);
+        framebuffer->EnableAov(AovDepth);
+        framebuffer->EnableAov(AovAlbedo);
+    }
+    denoiseSettings.threads = settings.threads;
+    auto resolveOutput = [&](const Framebuffer& fb, Image& target)
+    {
+        if (denoiseOutput)
+        {
+            denoise(fb, target, denoiseSettings);
+        }
+        else
+        {
+            fb.Resolve(target);
+        }
+    };
+
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    CheckpointInfo checkpointInfo;
+    checkpointInfo.fromSettings(settings);
+    if (!checkpointFilename.empty())
+    {
+        checkpointWriter.reset(new CheckpointWriter(checkpointFilename));
+    }
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+
+    // one thread, so pass images reach the file in order
+    FrameEncoder passEncoder(1);
+    Renderer renderer(sp, settings);
+    renderer.setPassCallback([&](const Framebuffer& fb, const RenderStats& passStats)
+    {
+        if (settings.progressive)
+        {
+            // every pass boundary leaves a complete image on disk; the
+            // write happens in the background while the next pass renders
+            Image* passImage = passEncoder.acquire(width, height, halfOutput);
+            resolveOutput(fb, *passImage);
+            passEncoder.submit(passImage, outputFilename, outputSettings);
+            std::cout << "pass " << passStats.passes << ": " << passStats.samples << " samples" << std::endl;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (checkpointWriter && now - lastCheckpoint >= std::chrono::seconds(checkpointInterval))
+        {
+            checkpointInfo.passes = passStats.passes;
+            checkpointInfo.samples = passStats.samples;
+            checkpointWriter->submit(fb, checkpointInfo);
+            lastCheckpoint = now;
+        }
+    });
+    activeRenderer = &renderer;
+    std::signal(SIGINT, onInterrupt);
+    std::signal(SIGTERM, onInterrupt);
+
+    RenderStats stats = renderer.render(*framebuffer, firstPass);
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    activeRenderer = nullptr;
+    printStats(stats);
+
+    if (checkpointWriter)
+    {
+        // an interrupted pass is safe to store: resuming simply runs it again
+        checkpointInfo.passes = stats.passes;
+        checkpointInfo.samples = stats.samples;
+        checkpointWriter->submit(*framebuffer, checkpointInfo);
+        checkpointWriter->flush();
+    }
+
+    passEncoder.flush();
+    resolveOutput(*framebuffer, image);
+    image.SaveImage(outputFilename, outputSettings);
+
+    std::unique_ptr<Image> reference;
+    if (!referenceFilename.empty())
+    {
+        reference.reset(Image::Load(referenceFilename));
+        if (!reference || reference->Width() != width || reference->Height() != height)
+        {
+            std::cout << "can't compare against " << referenceFilename << std::endl;
+            reference.reset();
+        }
+    }
+    if (reference)
+    {
+        std::unique_ptr<Image> noisy;
+        if (denoiseOutput)
+        {
+            noisy.reset(new Image(width, height));
+            framebuffer->Resolve(*noisy);
+        }
+        std::unique_ptr<Image> diff(diffFilename.empty() ? nullptr : new Image(width, height));
+        std::unique_ptr<Image> mask(maskFilename.empty() ? nullptr : new Image(width, height));
+        ImageError error = compareImages(image, *reference, compareSettings, diff.get(), mask.get());
+        printError(referenceFilename, error);
+        if (noisy)
+        {
+            ImageError noisyError = compareImages(*noisy, *reference, compareSettings);
+            std::cout << "before denoising: mse " << noisyError.mse << ", psnr " << noisyError.psnr
+                      << " dB, ssim " << noisyError.ssim << std::endl;
+        }
+        if (diff)
+        {
+            diff->SaveImage(diffFilename);
+        }
+        if (mask)
+        {
+            mask->SaveImage(maskFilename);
+        }
+    }
+
+    for (const AovOutput& aov : aovOutputs)
+    {
+        if (!aov.filename.empty())
+        {
+            Image plane(width, height);
+            framebuffer->ResolveAov(aov.type, plane, minDepth, maxDepth, settings.maxSamples);
+            plane.SaveImage(aov.filename);
+        }
+    }
+
+    if (!sampleCountFilename.empty())
+    {
+        Image counts(width, height);
+        framebuffer->ResolveSampleCounts(counts, std::max(settings.baseSamples, settings.maxSamples));
+        counts.SaveImage(sampleCountFilename);
+    }
 
     return 0;
 }
\ No newline at end of file